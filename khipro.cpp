@@ -24,17 +24,41 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include "khipro.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
-#include <iostream>
-#include <locale>
-#include <set>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define KHIPRO_X86_SIMD
+#endif
+
 using namespace std;
 
-unordered_map<string, string> vowels_map = {
+namespace khipro
+{
+
+constexpr key_mapping vowels_map[] = {
     {"o", "অ"}, {"a", "আ"}, {"i", "ই"}, {"ii", "ঈ"}, {"u", "উ"}, {"uu", "ঊ"},
     {"q", "ঋ"}, {"e", "এ"}, {"oi", "ঐ"}, {"w", "ও"}, {"ou", "ঔ"}, {"ae", "অ্যা"},
     {"wa", "ওয়া"}, {"we", "ওয়ে"}, {"wae", "ওয়্যা"},
@@ -43,7 +67,7 @@ unordered_map<string, string> vowels_map = {
     {"fq", "ৃ"}, {"fe", "ে"}, {"foi", "ৈ"}, {"fw", "ো"}, {"fou", "ৌ"}, {"fae", "্যা"},
     {"fwa", "োয়া"}, {"fwe", "োয়ে"}, {"fwae", "ওয়্যা"}, {"oo", "ং"}};
 
-unordered_map<string, string> vowel_signs_map = {
+constexpr key_mapping vowel_signs_map[] = {
     {"o", ""}, {"a", "া"}, {"i", "ি"}, {"ii", "ী"}, {"u", "ু"}, {"uu", "ূ"},
     {"q", "ৃ"}, {"e", "ে"}, {"oi", "ৈ"}, {"w", "ো"}, {"ou", "ৌ"}, {"ae", "্যা"},
     {"of", "অ"}, {"af", "আ"}, {"if", "ই"}, {"oif", "ই"}, {"iif", "ঈ"}, {"uf", "উ"}, {"ouf", "উ"}, {"uuf", "ঊ"},
@@ -51,7 +75,7 @@ unordered_map<string, string> vowel_signs_map = {
     {"uff", "‌ু"}, {"uuff", "‌ূ"}, {"qff", "‌ৃ"},
     {"we", "োয়ে"}, {"wef", "ওয়ে"}, {"waf", "ওয়া"}, {"wa", "োয়া"}, {"wae", "ওয়্যা"}};
 
-unordered_map<string, string> consonants_map = {
+constexpr key_mapping consonants_map[] = {
     {"k", "ক"}, {"kh", "খ"}, {"g", "গ"}, {"gh", "ঘ"}, {"ngf", "ঙ"},
     {"c", "চ"}, {"ch", "ছ"}, {"j", "জ"}, {"jh", "ঝ"}, {"nff", "ঞ"},
     {"tf", "ট"}, {"tff", "ঠ"}, {"df", "ড"}, {"dff", "ঢ"}, {"nf", "ণ"},
@@ -60,7 +84,7 @@ unordered_map<string, string> consonants_map = {
     {"l", "ল"}, {"sh", "শ"}, {"sf", "ষ"}, {"s", "স"}, {"h", "হ"},
     {"y", "য়"}, {"rf", "ড়"}, {"rff", "ঢ়"}, {",,", "়"}};
 
-unordered_map<string, string> conjuncts_map = {
+constexpr key_mapping conjuncts_map[] = {
     {"rz", "র‍্য"},
     {"kk", "ক্ক"}, {"ktf", "ক্ট"}, {"ktfr", "ক্ট্র"}, {"kt", "ক্ত"}, {"ktr", "ক্ত্র"}, {"kb", "ক্ব"}, {"km", "ক্ম"}, {"kz", "ক্য"}, {"kr", "ক্র"}, {"kl", "ক্ল"},
     {"kf", "ক্ষ"}, {"ksf", "ক্ষ"}, {"kkh", "ক্ষ"}, {"kfnf", "ক্ষ্ণ"}, {"kfn", "ক্ষ্ণ"}, {"ksfnf", "ক্ষ্ণ"}, {"ksfn", "ক্ষ্ণ"}, {"kkhn", "ক্ষ্ণ"}, {"kkhnf", "ক্ষ্ণ"},
@@ -263,23 +287,23 @@ unordered_map<string, string> conjuncts_map = {
 		{"ksfngof", "ক্ষঙঅ"}, {"ksfngaf", "ক্ষঙআ"}, {"ksfngif", "ক্ষঙই"}, {"ksfngiif", "ক্ষঙঈ"}, {"ksfnguf", "ক্ষঙউ"}, {"ksfnguuf", "ক্ষঙঊ"}, {"ksfngqf", "ক্ষঙঋ"}, {"ksfngef", "ক্ষঙএ"}, {"ksfngoif", "ক্ষঙই"},     
 		{"ksfngwf", "ক্ষঙও"}, {"ksfngouf", "ক্ষঙউ"}, {"ksfngaef", "ক্ষঙঅ্যা"}};
 
-unordered_map<string, string> reph_map = {{"rr", "র্"},
-                                          {"rae", "র‍্যা"}};
+constexpr key_mapping reph_map[] = {{"rr", "র্"},
+                                     {"rae", "র‍্যা"}};
 
-unordered_map<string, string> phola_map = {{"z", "য"}, {"r", "র"}};
+constexpr key_mapping phola_map[] = {{"z", "য"}, {"r", "র"}};
 
-unordered_map<string, string> diacritics_map = {
+constexpr key_mapping diacritics_map[] = {
     {"qq", "্"}, {"xx", "্‌"}, {"t/", "ৎ"}, {"x", "ঃ"},
     {"ng", "ং"}, {"/", "ঁ"}, {"//", "/"}, {"`", "`"},
     {"``", "‌"}, {"```", "``"}, {"~", "~"}, {"~~", "‍"}, {"~~~", "~~"}};
 
-unordered_map<string, string> punctuations_map = {
+constexpr key_mapping punctuations_map[] = {
     {";", ""}, {";;", ";"}, {".", "।"}, {"...", "..."},
     {"..", "."}, {"$", "৳"}, {"$f", "₹"}, {"$$", "$"},
     {",,,", ",,"}, {".f", "॥"}, {".ff", "৺"}, {"+", "+"},
     {"-", "-"}, {"=", "="}, {"+f", "×"}, {"-f", "÷"}, {"=f", "≠"}};
 
-unordered_map<string, string> digits_map = {
+constexpr key_mapping digits_map[] = {
     {".1", ".১"}, {".2", ".২"}, {".3", ".৩"}, {".4", ".৪"}, {".5", ".৫"},
     {".6", ".৬"}, {".7", ".৭"}, {".8", ".৮"}, {".9", ".৯"}, {".0", ".০"},
     {"1", "১"}, {"2", "২"}, {"3", "৩"}, {"4", "৪"}, {"5", "৫"},
@@ -290,186 +314,3150 @@ unordered_map<string, string> digits_map = {
     {"P", "p"}, {"Q", "q"}, {"R", "r"}, {"S", "s"}, {"T", "t"},
     {"U", "u"}, {"V", "v"}, {"W", "w"}, {"X", "x"}, {"Y", "y"}, {"Z", "z"}};
 
-set<string> global_keys_set;
-int max_token_length = 0;
+constexpr key_map_ref key_maps[key_map_count] = {
+    {conjuncts_map, size(conjuncts_map), TOKEN_CONJUNCT},
+    {consonants_map, size(consonants_map), TOKEN_CONSONANT},
+    {diacritics_map, size(diacritics_map), TOKEN_DIACRITIC},
+    {reph_map, size(reph_map), TOKEN_REPH},
+    {punctuations_map, size(punctuations_map), TOKEN_PUNCTUATION},
+    {phola_map, size(phola_map), TOKEN_PHOLA},
+    {vowels_map, size(vowels_map), TOKEN_VOWEL},
+    {vowel_signs_map, size(vowel_signs_map), TOKEN_VOWEL_SIGN},
+    {digits_map, size(digits_map), TOKEN_DIGIT}};
+
+// Section names of the text layout format, indexed by token_category.
+constexpr string_view key_map_names[key_map_count] = {
+    "conjuncts", "consonants", "diacritics", "reph", "punctuations",
+    "phola", "vowels", "vowel_signs", "digits"};
+
+namespace
+{
+
+constexpr string_view hasanta = "্";
 
-void initialize_global_keys()
+// Text emitted for a key right after a consonant, minus the hasanta that
+// phola keys prepend.
+constexpr string_view sign_output(const key_map_ref *maps, const key_mapping &mapping, token_category category)
 {
-  auto populate_globals = [&](const auto &map_to_add)
+  if (category == TOKEN_VOWEL)
   {
-    for (const auto &pair : map_to_add)
+    const key_map_ref &signs = maps[TOKEN_VOWEL_SIGN];
+    for (size_t i = 0; i < signs.size; ++i)
     {
-      global_keys_set.insert(pair.first);
-      if (pair.first.length() > max_token_length)
+      if (signs.mappings[i].key == mapping.key)
       {
-        max_token_length = pair.first.length();
+        return signs.mappings[i].value;
       }
     }
-  };
+  }
+  return mapping.value;
+}
 
-  populate_globals(vowels_map);
-  populate_globals(vowel_signs_map);
-  populate_globals(consonants_map);
-  populate_globals(conjuncts_map);
-  populate_globals(diacritics_map);
-  populate_globals(punctuations_map);
-  populate_globals(phola_map);
-  populate_globals(reph_map);
-  populate_globals(digits_map);
+struct key_layout
+{
+  size_t class_count;
+  size_t node_count;
+  size_t entry_count;
+  size_t pool_size;
+  size_t max_key_length;
+};
 
-  if (global_keys_set.empty())
+constexpr size_t total_key_bytes(const key_map_ref *maps)
+{
+  size_t total = 0;
+  for (size_t m = 0; m < key_map_count; ++m)
   {
-    max_token_length = 0;
+    for (size_t i = 0; i < maps[m].size; ++i)
+    {
+      total += maps[m].mappings[i].key.size();
+    }
   }
+  return total;
 }
 
-vector<string> tokenize(const string &text)
+// Sizes the compiled tables with a throwaway first-child/next-sibling trie,
+// which needs no class count up front. scratch provides zeroed first_child,
+// next_sibling, label and accepting arrays of total_key_bytes() + 1
+// elements.
+template <class Scratch>
+constexpr key_layout measure_tables(const key_map_ref *maps, Scratch &scratch)
 {
-  vector<string> tokens;
-  if (text.empty() || max_token_length == 0)
+  key_layout layout = {1, 1, 0, 0, 0};
+  bool seen_byte[256] = {};
+
+  for (size_t m = 0; m < key_map_count; ++m)
   {
-    if (!text.empty())
+    const key_map_ref &map = maps[m];
+    for (size_t i = 0; i < map.size; ++i)
     {
-      for (char c : text)
+      const key_mapping &mapping = map.mappings[i];
+      size_t node = 0;
+      for (char ch : mapping.key)
+      {
+        unsigned char c = ch;
+        if (!seen_byte[c])
+        {
+          seen_byte[c] = true;
+          layout.class_count++;
+        }
+        size_t child = scratch.first_child[node];
+        while (child != 0 && scratch.label[child] != c)
+        {
+          child = scratch.next_sibling[child];
+        }
+        if (child == 0)
+        {
+          child = layout.node_count++;
+          scratch.label[child] = c;
+          scratch.next_sibling[child] = scratch.first_child[node];
+          scratch.first_child[node] = child;
+        }
+        node = child;
+      }
+      if (!scratch.accepting[node])
       {
-        tokens.push_back(string(1, c));
+        scratch.accepting[node] = true;
+        layout.entry_count++;
+        layout.pool_size += mapping.value.size();
+        string_view sign = sign_output(maps, mapping, map.category);
+        if (map.category == TOKEN_PHOLA)
+        {
+          layout.pool_size += hasanta.size();
+        }
+        else if (sign != mapping.value)
+        {
+          layout.pool_size += sign.size();
+        }
       }
+      layout.max_key_length = max(layout.max_key_length, mapping.key.size());
     }
-    return tokens;
   }
+  return layout;
+}
 
-  size_t i = 0;
-  while (i < text.length())
+// Fills zeroed tables for maps, sized by measure_tables(). Tables is either
+// compiled_keys (arrays, at compile time) or table_pointers (into a
+// compiled keymap image, at run time).
+template <class Tables>
+constexpr void build_tables(const key_map_ref *maps, const key_layout &layout, Tables &keys)
+{
+  size_t class_count = 1;
+  size_t node_count = 1;
+  size_t entry_count = 0;
+  size_t pool_size = 0;
+  keys.max_output_per_key_byte = 1;
+
+  auto append = [&](string_view text)
+  {
+    for (char c : text)
+    {
+      keys.pool[pool_size++] = c;
+    }
+  };
+
+  for (size_t m = 0; m < key_map_count; ++m)
   {
-    bool matched = false;
-    for (int l = max_token_length; l > 0; --l)
+    const key_map_ref &map = maps[m];
+    for (size_t i = 0; i < map.size; ++i)
     {
-      if (i + l <= text.length())
+      const key_mapping &mapping = map.mappings[i];
+      size_t node = 0;
+      for (char ch : mapping.key)
+      {
+        unsigned char c = ch;
+        if (keys.byte_class[c] == 0)
+        {
+          keys.byte_class[c] = class_count++;
+        }
+        size_t slot = node * layout.class_count + keys.byte_class[c];
+        if (keys.transitions[slot] == 0)
+        {
+          keys.transitions[slot] = node_count++;
+        }
+        node = keys.transitions[slot];
+      }
+      if (keys.accept[node] != 0)
+      {
+        continue;
+      }
+
+      key_entry &entry = keys.entries[entry_count];
+      keys.accept[node] = ++entry_count;
+      string_view sign = sign_output(maps, mapping, map.category);
+      size_t longest_output =
+          max(mapping.value.size(), sign.size()) + (map.category == TOKEN_PHOLA ? hasanta.size() : 0);
+      keys.max_output_per_key_byte = max<size_t>(keys.max_output_per_key_byte,
+                                                 (longest_output + mapping.key.size() - 1) / mapping.key.size());
+      entry.category = map.category;
+      entry.leaves_consonant = map.category == TOKEN_CONJUNCT || map.category == TOKEN_CONSONANT ||
+                               map.category == TOKEN_PHOLA;
+      if (map.category == TOKEN_PHOLA)
+      {
+        // Stored as hasanta + phola so both outputs share the bytes.
+        entry.output_after_consonant_offset = pool_size;
+        entry.output_after_consonant_length = hasanta.size() + mapping.value.size();
+        append(hasanta);
+        entry.output_offset = pool_size;
+        entry.output_length = mapping.value.size();
+        append(mapping.value);
+      }
+      else
       {
-        string segment = text.substr(i, l);
-        if (global_keys_set.count(segment))
+        entry.output_offset = pool_size;
+        entry.output_length = mapping.value.size();
+        append(mapping.value);
+        entry.output_after_consonant_offset = entry.output_offset;
+        entry.output_after_consonant_length = entry.output_length;
+        if (sign != mapping.value)
         {
-          tokens.push_back(segment);
-          i += l;
-          matched = true;
-          break;
+          entry.output_after_consonant_offset = pool_size;
+          entry.output_after_consonant_length = sign.size();
+          append(sign);
         }
       }
     }
-    if (!matched)
+  }
+
+  keys.ascii_key_starts = true;
+  for (size_t c = 0; c < 256; ++c)
+  {
+    if (keys.transitions[keys.byte_class[c]] == 0)
     {
-      tokens.push_back(text.substr(i, 1));
-      i += 1;
+      continue;
     }
+    if (c >= 0x80)
+    {
+      keys.ascii_key_starts = false;
+      continue;
+    }
+    keys.start_low_nibble[c & 0x0f] |= 1 << (c >> 4);
+    keys.start_high_nibble[c >> 4] = 1 << (c >> 4);
   }
-  return tokens;
 }
 
-string transliterate(const string &input)
+constexpr size_t builtin_key_bytes = total_key_bytes(key_maps);
+
+template <size_t Capacity>
+struct measure_scratch
 {
-  string output_str;
-  vector<string> tokens = tokenize(input);
-  bool previous_was_consonant = false;
+  uint16_t first_child[Capacity];
+  uint16_t next_sibling[Capacity];
+  unsigned char label[Capacity];
+  bool accepting[Capacity];
+};
+
+constexpr key_layout measure_builtin()
+{
+  measure_scratch<builtin_key_bytes + 1> scratch = {};
+  return measure_tables(key_maps, scratch);
+}
 
-  for (const string &token : tokens)
+constexpr key_layout builtin_layout = measure_builtin();
+
+template <size_t Classes, size_t Nodes, size_t Entries, size_t PoolSize>
+struct compiled_keys
+{
+  unsigned char byte_class[256];
+  uint16_t transitions[Nodes * Classes];
+  uint16_t accept[Nodes];
+  key_entry entries[Entries];
+  char pool[PoolSize];
+  unsigned char start_low_nibble[16];
+  unsigned char start_high_nibble[16];
+  bool ascii_key_starts;
+  size_t max_output_per_key_byte;
+};
+
+using builtin_compiled_keys = compiled_keys<builtin_layout.class_count, builtin_layout.node_count,
+                                            builtin_layout.entry_count, builtin_layout.pool_size>;
+
+constexpr builtin_compiled_keys compile_builtin()
+{
+  builtin_compiled_keys keys = {};
+  build_tables(key_maps, builtin_layout, keys);
+  return keys;
+}
+
+constexpr builtin_compiled_keys builtin_compiled = compile_builtin();
+
+constexpr key_automaton builtin_keys = {
+    builtin_compiled.byte_class, builtin_layout.class_count,
+    builtin_compiled.transitions, builtin_compiled.accept,
+    builtin_compiled.entries, builtin_compiled.pool,
+    builtin_layout.max_key_length,
+    builtin_compiled.start_low_nibble, builtin_compiled.start_high_nibble,
+    builtin_compiled.ascii_key_starts, builtin_compiled.max_output_per_key_byte,
+    builtin_layout.node_count, builtin_layout.entry_count, builtin_layout.pool_size};
+
+} // namespace
+
+constexpr int max_token_length = builtin_layout.max_key_length;
+
+namespace
+{
+
+// Compiled keymap image, as written by keymap::save_compiled(): this header,
+// then byte_class[256], start_low_nibble[16], start_high_nibble[16], the
+// transitions, accept, (padding to 4 bytes), entries and the string pool.
+// Everything is in host byte order; byte_order tells a foreign file apart.
+struct compiled_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t class_count;
+  uint32_t node_count;
+  uint32_t entry_count;
+  uint32_t pool_size;
+  uint32_t max_key_length;
+  uint32_t max_output_per_key_byte;
+  uint32_t ascii_key_starts;
+  uint32_t reserved;
+};
+
+constexpr char compiled_magic[8] = {'K', 'H', 'I', 'P', 'R', 'O', 'K', 'M'};
+constexpr uint32_t compiled_version = 1;
+constexpr uint32_t compiled_byte_order = 0x01020304;
+
+static_assert(sizeof(key_entry) == 12 && alignof(key_entry) == 4, "key_entry is part of the compiled format");
+static_assert(sizeof(compiled_header) == 48, "compiled_header is part of the compiled format");
+
+struct compiled_offsets
+{
+  size_t byte_class;
+  size_t start_low_nibble;
+  size_t start_high_nibble;
+  size_t transitions;
+  size_t accept;
+  size_t entries;
+  size_t pool;
+  size_t size;
+};
+
+compiled_offsets image_offsets(size_t class_count, size_t node_count, size_t entry_count, size_t pool_size)
+{
+  compiled_offsets offsets;
+  offsets.byte_class = sizeof(compiled_header);
+  offsets.start_low_nibble = offsets.byte_class + 256;
+  offsets.start_high_nibble = offsets.start_low_nibble + 16;
+  offsets.transitions = offsets.start_high_nibble + 16;
+  offsets.accept = offsets.transitions + node_count * class_count * sizeof(uint16_t);
+  offsets.entries = (offsets.accept + node_count * sizeof(uint16_t) + 3) & ~size_t(3);
+  offsets.pool = offsets.entries + entry_count * sizeof(key_entry);
+  offsets.size = offsets.pool + pool_size;
+  return offsets;
+}
+
+// Validates a compiled image and returns a view into it. Every index the
+// engine follows is bounds-checked here, so a corrupt or hostile file cannot
+// make it read outside the image.
+key_automaton view_image(const char *image, size_t size)
+{
+  compiled_header header;
+  if (size < sizeof(header))
+  {
+    throw runtime_error("compiled keymap is truncated");
+  }
+  memcpy(&header, image, sizeof(header));
+  if (memcmp(header.magic, compiled_magic, sizeof(compiled_magic)) != 0)
+  {
+    throw runtime_error("not a compiled keymap");
+  }
+  if (header.version != compiled_version || header.byte_order != compiled_byte_order)
+  {
+    throw runtime_error("compiled keymap has an unsupported version or byte order");
+  }
+  if (header.class_count < 1 || header.class_count > 256 || header.node_count < 1 || header.node_count > 65535 ||
+      header.entry_count > 65535)
+  {
+    throw runtime_error("compiled keymap has invalid table sizes");
+  }
+  compiled_offsets offsets =
+      image_offsets(header.class_count, header.node_count, header.entry_count, header.pool_size);
+  if (offsets.size != size)
+  {
+    throw runtime_error("compiled keymap size does not match its header");
+  }
+
+  key_automaton keys;
+  keys.byte_class = reinterpret_cast<const unsigned char *>(image + offsets.byte_class);
+  keys.class_count = header.class_count;
+  keys.transitions = reinterpret_cast<const uint16_t *>(image + offsets.transitions);
+  keys.accept = reinterpret_cast<const uint16_t *>(image + offsets.accept);
+  keys.entries = reinterpret_cast<const key_entry *>(image + offsets.entries);
+  keys.pool = image + offsets.pool;
+  keys.start_low_nibble = reinterpret_cast<const unsigned char *>(image + offsets.start_low_nibble);
+  keys.start_high_nibble = reinterpret_cast<const unsigned char *>(image + offsets.start_high_nibble);
+  keys.node_count = header.node_count;
+  keys.entry_count = header.entry_count;
+  keys.pool_size = header.pool_size;
+
+  bool valid = true;
+  for (size_t c = 0; c < 256; ++c)
+  {
+    valid = valid && keys.byte_class[c] < keys.class_count;
+  }
+  for (size_t i = 0; i < keys.node_count * keys.class_count; ++i)
+  {
+    valid = valid && keys.transitions[i] < keys.node_count;
+  }
+  for (size_t i = 0; i < keys.node_count; ++i)
+  {
+    valid = valid && keys.accept[i] <= keys.entry_count;
+  }
+  // Offsets are checked in size_t, where offset + length cannot wrap.
+  auto in_pool = [&](size_t offset, size_t length)
+  { return offset <= keys.pool_size && length <= keys.pool_size - offset; };
+  for (size_t i = 0; i < keys.entry_count; ++i)
+  {
+    const key_entry &entry = keys.entries[i];
+    valid = valid && in_pool(entry.output_offset, entry.output_length) &&
+            in_pool(entry.output_after_consonant_offset, entry.output_after_consonant_length) &&
+            entry.category < key_map_count;
+    unsigned char leaves_consonant;
+    memcpy(&leaves_consonant, &entry.leaves_consonant, 1);
+    valid = valid && leaves_consonant <= 1;
+  }
+
+  // The transitions must form a tree under the root, so every walk ends
+  // within max_key_length bytes. The values derived from the tables are
+  // recomputed from them rather than taken from the header, and the start
+  // byte tables must match.
+  vector<bool> reached(keys.node_count, false);
+  vector<size_t> depth(keys.node_count, 0);
+  vector<size_t> queue(1, 0);
+  reached[0] = true;
+  keys.max_key_length = 0;
+  keys.max_output_per_key_byte = 1;
+  valid = valid && keys.accept[0] == 0;
+  for (size_t q = 0; valid && q < queue.size(); ++q)
   {
-    if (conjuncts_map.count(token))
+    size_t node = queue[q];
+    for (size_t c = 0; c < keys.class_count; ++c)
     {
-      output_str += conjuncts_map.at(token);
-      previous_was_consonant = true;
+      size_t child = keys.transitions[node * keys.class_count + c];
+      if (child == 0)
+      {
+        continue;
+      }
+      valid = valid && !reached[child];
+      reached[child] = true;
+      depth[child] = depth[node] + 1;
+      keys.max_key_length = max(keys.max_key_length, depth[child]);
+      queue.push_back(child);
     }
-    else if (consonants_map.count(token))
+    if (keys.accept[node] != 0)
     {
-      output_str += consonants_map.at(token);
-      previous_was_consonant = true;
+      const key_entry &entry = keys.entries[keys.accept[node] - 1];
+      size_t longest_output = max(entry.output_length, entry.output_after_consonant_length);
+      keys.max_output_per_key_byte =
+          max(keys.max_output_per_key_byte, (longest_output + depth[node] - 1) / depth[node]);
     }
-    else if (diacritics_map.count(token))
+  }
+  unsigned char start_low_nibble[16] = {};
+  unsigned char start_high_nibble[16] = {};
+  keys.ascii_key_starts = true;
+  for (size_t c = 0; c < 256; ++c)
+  {
+    if (keys.transitions[keys.byte_class[c]] == 0)
     {
-      output_str += diacritics_map.at(token);
-      previous_was_consonant = false;
+      continue;
     }
-    else if (reph_map.count(token))
+    if (c >= 0x80)
     {
-      output_str += reph_map.at(token);
-      previous_was_consonant = false;
+      keys.ascii_key_starts = false;
+      continue;
     }
-    else if (punctuations_map.count(token))
+    start_low_nibble[c & 0x0f] |= 1 << (c >> 4);
+    start_high_nibble[c >> 4] = 1 << (c >> 4);
+  }
+  valid = valid && memcmp(start_low_nibble, keys.start_low_nibble, 16) == 0 &&
+          memcmp(start_high_nibble, keys.start_high_nibble, 16) == 0;
+  if (!valid)
+  {
+    throw runtime_error("compiled keymap is corrupt");
+  }
+  return keys;
+}
+
+// Pointers into a zeroed image for build_tables().
+struct table_pointers
+{
+  unsigned char *byte_class;
+  uint16_t *transitions;
+  uint16_t *accept;
+  key_entry *entries;
+  char *pool;
+  unsigned char *start_low_nibble;
+  unsigned char *start_high_nibble;
+  bool ascii_key_starts;
+  size_t max_output_per_key_byte;
+};
+
+struct runtime_scratch
+{
+  vector<uint32_t> first_child;
+  vector<uint32_t> next_sibling;
+  vector<unsigned char> label;
+  vector<bool> accepting;
+};
+
+// Compiles maps into a fresh image in the compiled keymap format.
+shared_ptr<vector<char>> compile_image(const key_map_ref *maps)
+{
+  size_t capacity = total_key_bytes(maps) + 1;
+  runtime_scratch scratch = {vector<uint32_t>(capacity), vector<uint32_t>(capacity),
+                             vector<unsigned char>(capacity), vector<bool>(capacity)};
+  key_layout layout = measure_tables(maps, scratch);
+  if (layout.node_count > 65535 || layout.entry_count > 65535 || layout.pool_size > UINT32_MAX)
+  {
+    throw runtime_error("layout is too large to compile");
+  }
+  // Output lengths are stored in a byte, phola outputs with their hasanta.
+  for (size_t m = 0; m < key_map_count; ++m)
+  {
+    for (size_t i = 0; i < maps[m].size; ++i)
     {
-      output_str += punctuations_map.at(token);
-      previous_was_consonant = false;
+      if (maps[m].mappings[i].value.size() + (maps[m].category == TOKEN_PHOLA ? hasanta.size() : 0) > 255)
+      {
+        throw runtime_error("layout has an output longer than 255 bytes");
+      }
+    }
+  }
+
+  compiled_offsets offsets =
+      image_offsets(layout.class_count, layout.node_count, layout.entry_count, layout.pool_size);
+  auto image = make_shared<vector<char>>(offsets.size);
+  char *base = image->data();
+  table_pointers keys = {reinterpret_cast<unsigned char *>(base + offsets.byte_class),
+                         reinterpret_cast<uint16_t *>(base + offsets.transitions),
+                         reinterpret_cast<uint16_t *>(base + offsets.accept),
+                         reinterpret_cast<key_entry *>(base + offsets.entries),
+                         base + offsets.pool,
+                         reinterpret_cast<unsigned char *>(base + offsets.start_low_nibble),
+                         reinterpret_cast<unsigned char *>(base + offsets.start_high_nibble),
+                         false,
+                         1};
+  build_tables(maps, layout, keys);
+
+  compiled_header header = {};
+  memcpy(header.magic, compiled_magic, sizeof(compiled_magic));
+  header.version = compiled_version;
+  header.byte_order = compiled_byte_order;
+  header.class_count = layout.class_count;
+  header.node_count = layout.node_count;
+  header.entry_count = layout.entry_count;
+  header.pool_size = layout.pool_size;
+  header.max_key_length = layout.max_key_length;
+  header.max_output_per_key_byte = keys.max_output_per_key_byte;
+  header.ascii_key_starts = keys.ascii_key_starts;
+  memcpy(base, &header, sizeof(header));
+  return image;
+}
+
+// Reads the 4 hex digits of a \u escape at text[pos], advancing pos past
+// them.
+unsigned read_hex4(string_view text, size_t &pos, size_t line_number)
+{
+  unsigned code = 0;
+  for (size_t i = 0; i < 4; ++i, ++pos)
+  {
+    unsigned char c = pos < text.length() ? text[pos] : '"';
+    if (!isxdigit(c))
+    {
+      throw runtime_error("layout line " + to_string(line_number) + ": \\u needs 4 hex digits");
+    }
+    code = code << 4 | (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+  }
+  return code;
+}
+
+// Reads one double-quoted string starting at text[pos] (the opening quote),
+// handling the \", \\, \n, \t and \uXXXX escapes of the Python sources,
+// including surrogate pairs.
+string read_quoted(string_view text, size_t &pos, size_t line_number)
+{
+  string value;
+  for (++pos; pos < text.length() && text[pos] != '"'; ++pos)
+  {
+    if (text[pos] != '\\' || pos + 1 == text.length())
+    {
+      value += text[pos];
+      continue;
+    }
+    char escaped = text[++pos];
+    if (escaped == 'n')
+    {
+      value += '\n';
     }
-    else if (phola_map.count(token))
+    else if (escaped == 't')
     {
-      if (previous_was_consonant)
+      value += '\t';
+    }
+    else if (escaped == 'u')
+    {
+      ++pos;
+      unsigned code = read_hex4(text, pos, line_number);
+      if (code >= 0xd800 && code <= 0xdbff && text.substr(pos, 2) == "\\u")
+      {
+        pos += 2;
+        unsigned low = read_hex4(text, pos, line_number);
+        if (low < 0xdc00 || low > 0xdfff)
+        {
+          throw runtime_error("layout line " + to_string(line_number) + ": unpaired surrogate in \\u escape");
+        }
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+      }
+      else if (code >= 0xd800 && code <= 0xdfff)
+      {
+        throw runtime_error("layout line " + to_string(line_number) + ": unpaired surrogate in \\u escape");
+      }
+      // The loop steps past the last digit.
+      --pos;
+      if (code < 0x80)
+      {
+        value += char(code);
+      }
+      else if (code < 0x800)
+      {
+        value += char(0xc0 | code >> 6);
+        value += char(0x80 | (code & 0x3f));
+      }
+      else if (code < 0x10000)
       {
-        output_str += "্";
-        output_str += phola_map.at(token);
+        value += char(0xe0 | code >> 12);
+        value += char(0x80 | (code >> 6 & 0x3f));
+        value += char(0x80 | (code & 0x3f));
       }
       else
       {
-        output_str += phola_map.at(token);
+        value += char(0xf0 | code >> 18);
+        value += char(0x80 | (code >> 12 & 0x3f));
+        value += char(0x80 | (code >> 6 & 0x3f));
+        value += char(0x80 | (code & 0x3f));
       }
-      previous_was_consonant = true;
     }
-    else if (vowels_map.count(token))
+    else
+    {
+      value += escaped;
+    }
+  }
+  if (pos == text.length())
+  {
+    throw runtime_error("layout line " + to_string(line_number) + ": unterminated string");
+  }
+  ++pos;
+  return value;
+}
+
+int layout_section(string_view name)
+{
+  string lower;
+  for (char c : name)
+  {
+    lower += tolower((unsigned char)c);
+  }
+  if (lower.length() > 4 && lower.compare(lower.length() - 4, 4, "_map") == 0)
+  {
+    lower.resize(lower.length() - 4);
+  }
+  for (size_t i = 0; i < key_map_count; ++i)
+  {
+    if (lower == key_map_names[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+key_match match_in(const key_automaton &keys, string_view text, size_t pos)
+{
+  key_match match = {0, nullptr, 0, true};
+  size_t node = 0;
+  for (size_t i = pos; i < text.length(); ++i)
+  {
+    node = keys.transitions[node * keys.class_count + keys.byte_class[(unsigned char)text[i]]];
+    if (node == 0)
+    {
+      match.scanned = i - pos + 1;
+      match.open = false;
+      return match;
+    }
+    if (keys.accept[node] != 0)
+    {
+      match.length = i - pos + 1;
+      match.entry = &keys.entries[keys.accept[node] - 1];
+    }
+  }
+  match.scanned = text.length() - pos;
+  return match;
+}
+
+string_view key_output(const key_automaton &keys, const key_entry &entry, bool previous_was_consonant)
+{
+  if (previous_was_consonant)
+  {
+    return string_view(keys.pool + entry.output_after_consonant_offset, entry.output_after_consonant_length);
+  }
+  return string_view(keys.pool + entry.output_offset, entry.output_length);
+}
+
+bool starts_key(const key_automaton &keys, char c)
+{
+  return keys.transitions[keys.byte_class[(unsigned char)c]] != 0;
+}
+
+} // namespace
+
+const keymap &keymap::builtin()
+{
+  static const keymap builtin_map(builtin_keys, nullptr, string_view());
+  return builtin_map;
+}
+
+keymap keymap::compile(const key_map_ref *maps)
+{
+  shared_ptr<vector<char>> image = compile_image(maps);
+  string_view view(image->data(), image->size());
+  return keymap(view_image(view.data(), view.size()), image, view);
+}
+
+keymap keymap::from_layout(string_view text)
+{
+  vector<string> strings[key_map_count];
+  int section = -1;
+  size_t line_number = 0;
+  size_t line_start = 0;
+  while (line_start < text.length())
+  {
+    size_t line_end = min(text.find('\n', line_start), text.length());
+    string_view line = text.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+    ++line_number;
+
+    vector<string> quoted;
+    bool named = false;
+    size_t pos = 0;
+    while (pos < line.length() && line[pos] != '#' && line[pos] != ';')
     {
-      if (previous_was_consonant)
+      if (line[pos] == '"')
+      {
+        quoted.push_back(read_quoted(line, pos, line_number));
+      }
+      else if (!named && quoted.empty() && (isalpha((unsigned char)line[pos]) || line[pos] == '_'))
       {
-        if (vowel_signs_map.count(token))
+        size_t end = pos;
+        while (end < line.length() && (isalnum((unsigned char)line[end]) || line[end] == '_'))
         {
-          output_str += vowel_signs_map.at(token);
+          ++end;
         }
-        else
+        section = layout_section(line.substr(pos, end - pos));
+        if (section < 0)
         {
-          output_str += vowels_map.at(token);
+          throw runtime_error("layout line " + to_string(line_number) + ": unknown section \"" +
+                              string(line.substr(pos, end - pos)) + "\"");
         }
+        named = true;
+        pos = end;
       }
       else
       {
-        output_str += vowels_map.at(token);
+        ++pos;
       }
-      previous_was_consonant = false;
     }
-    else if (vowel_signs_map.count(token))
+    if (quoted.empty())
     {
-      output_str += vowel_signs_map.at(token);
-      previous_was_consonant = false;
+      continue;
     }
-    else if (digits_map.count(token))
+    if (section < 0)
     {
-      output_str += digits_map.at(token);
-      previous_was_consonant = false;
+      throw runtime_error("layout line " + to_string(line_number) + ": mapping outside a section");
     }
-    else
+    if (quoted.size() % 2 != 0)
     {
-      output_str += token;
-      previous_was_consonant = false;
+      throw runtime_error("layout line " + to_string(line_number) + ": key without a value");
+    }
+    for (size_t i = 0; i < quoted.size(); i += 2)
+    {
+      // Phola outputs are stored with a hasanta in front, in the same 255
+      // bytes.
+      size_t value_limit = section == TOKEN_PHOLA ? 255 - hasanta.size() : 255;
+      if (quoted[i].empty() || quoted[i].length() > 255 || quoted[i + 1].length() > value_limit)
+      {
+        throw runtime_error("layout line " + to_string(line_number) + ": empty or overlong key or value");
+      }
+      strings[section].push_back(move(quoted[i]));
+      strings[section].push_back(move(quoted[i + 1]));
+    }
+  }
+
+  vector<key_mapping> mappings[key_map_count];
+  key_map_ref maps[key_map_count];
+  for (size_t m = 0; m < key_map_count; ++m)
+  {
+    for (size_t i = 0; i < strings[m].size(); i += 2)
+    {
+      mappings[m].push_back({strings[m][i], strings[m][i + 1]});
     }
+    maps[m] = {mappings[m].data(), mappings[m].size(), token_category(m)};
   }
-  return output_str;
+  return compile(maps);
 }
 
-int main()
+keymap keymap::load(const string &path)
 {
-  initialize_global_keys();
-
-  cout << "khipro cpp" << endl;
-  cout << "type 'exit' to quit." << endl;
-
-  string sample_input;
-  while (true)
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0)
   {
-    cout << "Enter input: ";
-    getline(cin, sample_input);
-
-    if (sample_input == "exit")
+    if (fd >= 0)
     {
-      break;
+      close(fd);
+    }
+    throw runtime_error(path + ": " + strerror(errno));
+  }
+  shared_ptr<const void> storage;
+  string_view image;
+  if (S_ISREG(info.st_mode))
+  {
+    size_t size = info.st_size;
+    void *mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+      throw runtime_error(path + ": cannot map file");
     }
+    storage = shared_ptr<const void>(mapped, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+    image = string_view(static_cast<const char *>(mapped), size);
+  }
+  else
+  {
+    // Pipes and devices (--layout <(...), /dev/stdin) cannot be mapped.
+    auto contents = make_shared<string>();
+    char buffer[65536];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+      if (count < 0 && errno != EINTR)
+      {
+        int error = errno;
+        close(fd);
+        throw runtime_error(path + ": " + strerror(error));
+      }
+      contents->append(buffer, max<ssize_t>(count, 0));
+    }
+    close(fd);
+    storage = contents;
+    image = *contents;
+  }
 
-    string result = transliterate(sample_input);
-    cout << "Output: " << result << endl;
+  try
+  {
+    if (image.substr(0, sizeof(compiled_magic)) == string_view(compiled_magic, sizeof(compiled_magic)))
+    {
+      return keymap(view_image(image.data(), image.size()), storage, image);
+    }
+    return from_layout(image);
+  }
+  catch (const runtime_error &error)
+  {
+    throw runtime_error(path + ": " + error.what());
   }
+}
 
-  return 0;
+void keymap::save_compiled(const string &path) const
+{
+  shared_ptr<vector<char>> builtin_image;
+  string_view image = image_;
+  if (image.empty())
+  {
+    builtin_image = compile_image(key_maps);
+    image = string_view(builtin_image->data(), builtin_image->size());
+  }
+  ofstream file(path, ios::binary | ios::trunc);
+  file.write(image.data(), image.size());
+  file.close();
+  if (!file)
+  {
+    throw runtime_error(path + ": cannot write compiled keymap");
+  }
 }
+
+string format_layout(const key_map_ref *maps)
+{
+  auto quote = [](string_view text)
+  {
+    string quoted = "\"";
+    for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+      {
+        quoted += '\\';
+        quoted += c;
+      }
+      else if (c == '\n')
+      {
+        quoted += "\\n";
+      }
+      else if (c == '\t')
+      {
+        quoted += "\\t";
+      }
+      else
+      {
+        quoted += c;
+      }
+    }
+    return quoted + '"';
+  };
+
+  string text;
+  for (size_t m = 0; m < key_map_count; ++m)
+  {
+    text += (m == 0 ? "[" : "\n[") + string(key_map_names[m]) + "]\n";
+    for (size_t i = 0; i < maps[m].size; ++i)
+    {
+      text += quote(maps[m].mappings[i].key) + " " + quote(maps[m].mappings[i].value) + "\n";
+    }
+  }
+  return text;
+}
+
+namespace
+{
+
+// Length of the run at the front of text made of bytes that start no key
+// (spaces, most punctuation, existing UTF-8). Such bytes are copied through
+// unchanged, so the whole run can be appended at once.
+size_t pass_through_length_scalar(const key_automaton &keys, const char *text, size_t length)
+{
+  size_t i = 0;
+  while (i < length && !starts_key(keys, text[i]))
+  {
+    ++i;
+  }
+  return i;
+}
+
+#if defined(KHIPRO_X86_SIMD)
+__attribute__((target("ssse3"))) size_t pass_through_length_ssse3(const key_automaton &keys, const char *text,
+                                                                  size_t length)
+{
+  const __m128i low_table = _mm_loadu_si128((const __m128i *)keys.start_low_nibble);
+  const __m128i high_table = _mm_loadu_si128((const __m128i *)keys.start_high_nibble);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i low = _mm_shuffle_epi8(low_table, _mm_and_si128(bytes, nibble));
+    __m128i high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+    unsigned starts = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128())) & 0xffff;
+    if (starts)
+    {
+      return i + __builtin_ctz(starts);
+    }
+  }
+  return i + pass_through_length_scalar(keys, text + i, length - i);
+}
+
+__attribute__((target("avx2"))) size_t pass_through_length_avx2(const key_automaton &keys, const char *text,
+                                                                size_t length)
+{
+  const __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)keys.start_low_nibble));
+  const __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)keys.start_high_nibble));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(bytes, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    unsigned starts = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(low, high),
+                                                                        _mm256_setzero_si256()));
+    if (starts)
+    {
+      return i + __builtin_ctz(starts);
+    }
+  }
+  return i + pass_through_length_ssse3(keys, text + i, length - i);
+}
+#endif
+
+} // namespace
+
+size_t pass_through_length(const key_automaton &keys, const char *text, size_t length)
+{
+  // Most runs are a lone space; only longer ones go to the vector scan.
+  size_t head = min<size_t>(length, 8);
+  size_t i = pass_through_length_scalar(keys, text, head);
+  if (i < head)
+  {
+    return i;
+  }
+  text += i;
+  length -= i;
+#if defined(KHIPRO_X86_SIMD)
+  static const auto scan = []
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return pass_through_length_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+      return pass_through_length_ssse3;
+    }
+    return pass_through_length_scalar;
+  }();
+  if (!keys.ascii_key_starts)
+  {
+    return i + pass_through_length_scalar(keys, text, length);
+  }
+  return i + scan(keys, text, length);
+#else
+  return i + pass_through_length_scalar(keys, text, length);
+#endif
+}
+
+key_match match_key(string_view text, size_t pos, const keymap &keys)
+{
+  return match_in(keys.automaton(), text, pos);
+}
+
+namespace
+{
+
+// UTF-8. A sequence is well formed as in table 3-7 of the Unicode standard:
+// no overlong forms, surrogates or code points past U+10FFFF.
+struct utf8_sequence
+{
+  // Bytes in the sequence, or if it is malformed, in its maximal subpart:
+  // the longest prefix of a well-formed sequence, or 1.
+  size_t length;
+  bool valid;
+  // Set when a malformed sequence is only cut off by the end of text.
+  bool truncated;
+};
+
+utf8_sequence utf8_sequence_at(string_view text, size_t pos)
+{
+  unsigned char lead = text[pos];
+  if (lead < 0x80)
+  {
+    return {1, true, false};
+  }
+  size_t length;
+  unsigned char low = 0x80;
+  unsigned char high = 0xbf;
+  if (lead >= 0xc2 && lead <= 0xdf)
+  {
+    length = 2;
+  }
+  else if (lead >= 0xe0 && lead <= 0xef)
+  {
+    length = 3;
+    low = lead == 0xe0 ? 0xa0 : 0x80;
+    high = lead == 0xed ? 0x9f : 0xbf;
+  }
+  else if (lead >= 0xf0 && lead <= 0xf4)
+  {
+    length = 4;
+    low = lead == 0xf0 ? 0x90 : 0x80;
+    high = lead == 0xf4 ? 0x8f : 0xbf;
+  }
+  else
+  {
+    return {1, false, false};
+  }
+  for (size_t i = 1; i < length; ++i)
+  {
+    if (pos + i == text.length())
+    {
+      return {i, false, true};
+    }
+    unsigned char c = text[pos + i];
+    if (c < low || c > high)
+    {
+      return {i, false, false};
+    }
+    low = 0x80;
+    high = 0xbf;
+  }
+  return {length, true, false};
+}
+
+size_t malformed_utf8_scalar(const char *text, size_t length)
+{
+  string_view view(text, length);
+  size_t i = 0;
+  while (i < length)
+  {
+    // ASCII 8 bytes at a time.
+    uint64_t word;
+    if (i + 8 <= length && (memcpy(&word, text + i, 8), (word & 0x8080808080808080ull) == 0))
+    {
+      i += 8;
+      continue;
+    }
+    utf8_sequence sequence = utf8_sequence_at(view, i);
+    if (!sequence.valid)
+    {
+      return i;
+    }
+    i += sequence.length;
+  }
+  return length;
+}
+
+// Where the scalar check resumes after the vector check stopped at block:
+// the start of the sequence holding the byte before it. Everything earlier
+// has been checked, including how it continues into block.
+size_t utf8_resume(const char *text, size_t block)
+{
+  if (block == 0)
+  {
+    return 0;
+  }
+  size_t i = block - 1;
+  while (i > 0 && block - i < 4 && (text[i] & 0xc0) == 0x80)
+  {
+    --i;
+  }
+  return i;
+}
+
+#if defined(KHIPRO_X86_SIMD)
+// The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less Than
+// One Instruction Per Byte" (2021). Each byte is classified with the one
+// before it by three 16-entry table lookups, on the high and low nibbles of
+// the previous byte and the high nibble of this one; a bit left set in all
+// three is an error. Third and fourth bytes of longer sequences are checked
+// separately. Pure ASCII blocks skip all of it. The vector code only finds
+// the first block with an error; utf8_resume() and the scalar check then
+// find the byte.
+constexpr char utf8_too_short = 1 << 0;
+constexpr char utf8_too_long = 1 << 1;
+constexpr char utf8_overlong_3 = 1 << 2;
+constexpr char utf8_too_large = 1 << 3;
+constexpr char utf8_surrogate = 1 << 4;
+constexpr char utf8_overlong_2 = 1 << 5;
+constexpr char utf8_too_large_1000 = 1 << 6;
+constexpr char utf8_overlong_4 = 1 << 6;
+constexpr char utf8_two_continuations = char(1 << 7);
+constexpr char utf8_carry = utf8_too_short | utf8_too_long | utf8_two_continuations;
+
+// Indexed by the high nibble of the previous byte.
+alignas(16) constexpr char utf8_byte_1_high[16] = {
+    utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long,
+    utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long,
+    utf8_two_continuations, utf8_two_continuations, utf8_two_continuations, utf8_two_continuations,
+    utf8_too_short | utf8_overlong_2,
+    utf8_too_short,
+    utf8_too_short | utf8_overlong_3 | utf8_surrogate,
+    utf8_too_short | utf8_too_large | utf8_too_large_1000 | utf8_overlong_4};
+
+// Indexed by the low nibble of the previous byte.
+alignas(16) constexpr char utf8_byte_1_low[16] = {
+    utf8_carry | utf8_overlong_3 | utf8_overlong_2 | utf8_overlong_4,
+    utf8_carry | utf8_overlong_2,
+    utf8_carry,
+    utf8_carry,
+    utf8_carry | utf8_too_large,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000 | utf8_surrogate,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000};
+
+// Indexed by the high nibble of this byte.
+alignas(16) constexpr char utf8_byte_2_high[16] = {
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_overlong_3 | utf8_too_large_1000 | utf8_overlong_4,
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_overlong_3 | utf8_too_large,
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_surrogate | utf8_too_large,
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_surrogate | utf8_too_large,
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short};
+
+__attribute__((target("ssse3"))) size_t malformed_utf8_ssse3(const char *text, size_t length)
+{
+  const __m128i byte_1_high = _mm_load_si128((const __m128i *)utf8_byte_1_high);
+  const __m128i byte_1_low = _mm_load_si128((const __m128i *)utf8_byte_1_low);
+  const __m128i byte_2_high = _mm_load_si128((const __m128i *)utf8_byte_2_high);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  // A block ending in a lead byte at or above these needs more bytes.
+  const __m128i complete_below = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xef),
+                                               char(0xdf), char(0xbf));
+  __m128i previous = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i input = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i error;
+    if (_mm_movemask_epi8(input) == 0)
+    {
+      error = _mm_subs_epu8(previous, complete_below);
+    }
+    else
+    {
+      __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+      __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+      __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+      __m128i special = _mm_and_si128(
+          _mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                        _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+          _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+      __m128i must_continue = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(char(0xe0 - 0x80))),
+                                           _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xf0 - 0x80))));
+      error = _mm_xor_si128(_mm_and_si128(must_continue, _mm_set1_epi8(char(0x80))), special);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff)
+    {
+      break;
+    }
+    previous = input;
+  }
+  size_t resume = utf8_resume(text, i);
+  return resume + malformed_utf8_scalar(text + resume, length - resume);
+}
+
+__attribute__((target("avx2"))) size_t malformed_utf8_avx2(const char *text, size_t length)
+{
+  const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)utf8_byte_1_high));
+  const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)utf8_byte_1_low));
+  const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)utf8_byte_2_high));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i complete_below =
+      _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1, -1, -1, -1, -1, -1, char(0xef), char(0xdf), char(0xbf));
+  __m256i previous = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i input = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i error;
+    if (_mm256_movemask_epi8(input) == 0)
+    {
+      error = _mm256_subs_epu8(previous, complete_below);
+    }
+    else
+    {
+      // alignr works within 128-bit lanes, so each lane is given the one
+      // before it.
+      __m256i before = _mm256_permute2x128_si256(previous, input, 0x21);
+      __m256i prev1 = _mm256_alignr_epi8(input, before, 15);
+      __m256i prev2 = _mm256_alignr_epi8(input, before, 14);
+      __m256i prev3 = _mm256_alignr_epi8(input, before, 13);
+      __m256i special = _mm256_and_si256(
+          _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                           _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+          _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+      __m256i must_continue = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xe0 - 0x80))),
+                                              _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xf0 - 0x80))));
+      error = _mm256_xor_si256(_mm256_and_si256(must_continue, _mm256_set1_epi8(char(0x80))), special);
+    }
+    if (!_mm256_testz_si256(error, error))
+    {
+      break;
+    }
+    previous = input;
+  }
+  size_t resume = utf8_resume(text, i);
+  return resume + malformed_utf8_scalar(text + resume, length - resume);
+}
+#endif
+
+} // namespace
+
+size_t find_malformed_utf8(string_view text)
+{
+#if defined(KHIPRO_X86_SIMD)
+  static const auto scan = []
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return malformed_utf8_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+      return malformed_utf8_ssse3;
+    }
+    return malformed_utf8_scalar;
+  }();
+  return scan(text.data(), text.length());
+#else
+  return malformed_utf8_scalar(text.data(), text.length());
+#endif
+}
+
+size_t complete_utf8_length(string_view text)
+{
+  size_t start = utf8_resume(text.data(), text.length());
+  if (start == text.length())
+  {
+    return start;
+  }
+  utf8_sequence last = utf8_sequence_at(text, start);
+  return last.truncated ? start : text.length();
+}
+
+vector<string> tokenize(string_view text, const keymap &keys)
+{
+  const key_automaton &automaton = keys.automaton();
+  vector<string> tokens;
+  size_t i = 0;
+  while (i < text.length())
+  {
+    if (!starts_key(automaton, text[i]))
+    {
+      // Input no key matches is split into whole code points.
+      size_t end = i + pass_through_length(automaton, text.data() + i, text.length() - i);
+      while (i < end)
+      {
+        utf8_sequence sequence = utf8_sequence_at(text, i);
+        size_t l = min(sequence.valid ? sequence.length : 1, end - i);
+        tokens.emplace_back(text.substr(i, l));
+        i += l;
+      }
+      continue;
+    }
+    size_t l = max<size_t>(match_in(automaton, text, i).length, 1);
+    tokens.emplace_back(text.substr(i, l));
+    i += l;
+  }
+  return tokens;
+}
+
+namespace
+{
+
+// Statistics. engine_stats is all uint64_t, so counters are handled as an
+// array indexed by field offset.
+constexpr size_t stat_count = sizeof(engine_stats) / sizeof(uint64_t);
+static_assert(sizeof(engine_stats) == stat_count * sizeof(uint64_t), "engine_stats must be all uint64_t");
+
+// Tallies one call on the stack and adds the tally to the calling thread's
+// counters when it finishes, so hot loops never touch thread-local storage.
+// Without KHIPRO_STATS it does nothing.
+template <bool Enabled>
+struct call_recorder
+{
+  explicit call_recorder(bool) {}
+  void key(const key_match &) {}
+  void copied(size_t, bool) {}
+  void finish(size_t, size_t) {}
+};
+
+#if defined(KHIPRO_STATS)
+// Counters of one thread. Only their thread writes them, with a plain load
+// and store, so counting needs no locked instructions and a snapshot can
+// still read them from another thread.
+struct thread_counters
+{
+  atomic<uint64_t> values[stat_count] = {};
+
+  thread_counters();
+  ~thread_counters();
+};
+
+mutex stats_mutex;
+vector<thread_counters *> live_counters;
+uint64_t retired_counters[stat_count];
+
+thread_counters::thread_counters()
+{
+  lock_guard<mutex> lock(stats_mutex);
+  live_counters.push_back(this);
+}
+
+thread_counters::~thread_counters()
+{
+  lock_guard<mutex> lock(stats_mutex);
+  for (size_t i = 0; i < stat_count; ++i)
+  {
+    retired_counters[i] += values[i].load(memory_order_relaxed);
+  }
+  live_counters.erase(find(live_counters.begin(), live_counters.end(), this));
+}
+
+thread_local thread_counters local_counters;
+
+template <>
+struct call_recorder<true>
+{
+  engine_stats tally = {};
+  bool keystroke;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  explicit call_recorder(bool is_keystroke) : keystroke(is_keystroke) {}
+
+  void key(const key_match &match)
+  {
+    tally.scan_lengths[min(match.scanned, engine_stats::scan_buckets - 1)]++;
+    if (match.length != 0)
+    {
+      tally.tokens[match.entry->category]++;
+    }
+    else
+    {
+      tally.unmatched_bytes++;
+    }
+  }
+
+  void copied(size_t count, bool starts_no_key)
+  {
+    (starts_no_key ? tally.pass_through_bytes : tally.unmatched_bytes) += count;
+  }
+
+  void finish(size_t bytes_in, size_t bytes_out)
+  {
+    uint64_t nanoseconds =
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    size_t bucket = min<size_t>(64 - (nanoseconds ? __builtin_clzll(nanoseconds) : 64),
+                                engine_stats::latency_buckets - 1);
+    if (keystroke)
+    {
+      tally.keystroke_latency[bucket]++;
+    }
+    else
+    {
+      tally.calls++;
+      tally.call_latency[bucket]++;
+    }
+    tally.bytes_in += bytes_in;
+    tally.bytes_out += bytes_out;
+
+    const uint64_t *counts = reinterpret_cast<const uint64_t *>(&tally);
+    thread_counters &counters = local_counters;
+    for (size_t i = 0; i < stat_count; ++i)
+    {
+      if (counts[i] != 0)
+      {
+        counters.values[i].store(counters.values[i].load(memory_order_relaxed) + counts[i], memory_order_relaxed);
+      }
+    }
+  }
+};
+
+constexpr bool statistics = true;
+#else
+constexpr bool statistics = false;
+#endif
+
+using recorder = call_recorder<statistics>;
+
+} // namespace
+
+bool stats_enabled()
+{
+  return statistics;
+}
+
+engine_stats stats_snapshot()
+{
+  uint64_t counts[stat_count] = {};
+#if defined(KHIPRO_STATS)
+  lock_guard<mutex> lock(stats_mutex);
+  for (size_t i = 0; i < stat_count; ++i)
+  {
+    counts[i] = retired_counters[i];
+    for (thread_counters *counters : live_counters)
+    {
+      counts[i] += counters->values[i].load(memory_order_relaxed);
+    }
+  }
+#endif
+  engine_stats snapshot;
+  memcpy(&snapshot, counts, sizeof(snapshot));
+  return snapshot;
+}
+
+void reset_stats()
+{
+#if defined(KHIPRO_STATS)
+  lock_guard<mutex> lock(stats_mutex);
+  for (size_t i = 0; i < stat_count; ++i)
+  {
+    retired_counters[i] = 0;
+    for (thread_counters *counters : live_counters)
+    {
+      counters->values[i].store(0, memory_order_relaxed);
+    }
+  }
+#endif
+}
+
+namespace
+{
+
+// Output targets for transliterate_into(): a growing string, or a fixed
+// buffer that keeps counting once it is full.
+struct string_sink
+{
+  string &output;
+
+  void append(const char *data, size_t length) { output.append(data, length); }
+  size_t written() const { return output.length(); }
+};
+
+struct buffer_sink
+{
+  char *buffer;
+  size_t capacity;
+  size_t length;
+
+  void append(const char *data, size_t count)
+  {
+    if (length < capacity)
+    {
+      memcpy(buffer + length, data, min(count, capacity - length));
+    }
+    length += count;
+  }
+  size_t written() const { return length; }
+};
+
+template <class Sink>
+size_t transliterate_into(const key_automaton &keys, string_view input, Sink &sink, bool &previous_was_consonant,
+                          bool final)
+{
+  recorder record(false);
+  size_t written = sink.written();
+  size_t i = 0;
+  while (i < input.length())
+  {
+    if (!starts_key(keys, input[i]))
+    {
+      size_t run = pass_through_length(keys, input.data() + i, input.length() - i);
+      sink.append(input.data() + i, run);
+      record.copied(run, true);
+      previous_was_consonant = false;
+      i += run;
+      continue;
+    }
+    key_match match = match_in(keys, input, i);
+    if (match.open && !final)
+    {
+      break;
+    }
+    record.key(match);
+    if (match.length == 0)
+    {
+      sink.append(input.data() + i, 1);
+      previous_was_consonant = false;
+      i += 1;
+      continue;
+    }
+    string_view output = key_output(keys, *match.entry, previous_was_consonant);
+    sink.append(output.data(), output.length());
+    previous_was_consonant = match.entry->leaves_consonant;
+    i += match.length;
+  }
+  record.finish(i, sink.written() - written);
+  return i;
+}
+
+} // namespace
+
+size_t transliterate_chunk(string_view input, string &output, bool &previous_was_consonant, bool final,
+                           const keymap &keys)
+{
+  string_sink sink = {output};
+  return transliterate_into(keys.automaton(), input, sink, previous_was_consonant, final);
+}
+
+void transliterate(string_view input, string &output, const keymap &keys)
+{
+  bool previous_was_consonant = false;
+  transliterate_chunk(input, output, previous_was_consonant, true, keys);
+}
+
+string transliterate(string_view input, const keymap &keys)
+{
+  string output;
+  output.reserve(transliterated_size_bound(input, keys));
+  transliterate(input, output, keys);
+  return output;
+}
+
+size_t transliterate(string_view input, char *buffer, size_t capacity, const keymap &keys)
+{
+  buffer_sink sink = {buffer, capacity, 0};
+  bool previous_was_consonant = false;
+  transliterate_into(keys.automaton(), input, sink, previous_was_consonant, true);
+  return sink.length;
+}
+
+size_t transliterated_size_bound(string_view input, const keymap &keys)
+{
+  return input.length() * keys.automaton().max_output_per_key_byte;
+}
+
+key_profile profile_keys(string_view text, const keymap &keys)
+{
+  const key_automaton &automaton = keys.automaton();
+  key_profile profile;
+  profile.transitions.assign(automaton.node_count * automaton.class_count, 0);
+  profile.nodes.assign(automaton.node_count, 0);
+  profile.outputs.assign(automaton.entry_count * 2, 0);
+  bool previous_was_consonant = false;
+  size_t i = 0;
+  while (i < text.length())
+  {
+    if (!starts_key(automaton, text[i]))
+    {
+      i += pass_through_length(automaton, text.data() + i, text.length() - i);
+      previous_was_consonant = false;
+      continue;
+    }
+    // The walk of match_in(), counted.
+    size_t node = 0;
+    size_t length = 0;
+    const key_entry *entry = nullptr;
+    for (size_t j = i; j < text.length(); ++j)
+    {
+      size_t slot = node * automaton.class_count + automaton.byte_class[(unsigned char)text[j]];
+      profile.transitions[slot]++;
+      node = automaton.transitions[slot];
+      if (node == 0)
+      {
+        break;
+      }
+      profile.nodes[node]++;
+      if (automaton.accept[node] != 0)
+      {
+        length = j - i + 1;
+        entry = &automaton.entries[automaton.accept[node] - 1];
+      }
+    }
+    if (length == 0)
+    {
+      previous_was_consonant = false;
+      i += 1;
+      continue;
+    }
+    profile.outputs[(entry - automaton.entries) * 2 + previous_was_consonant]++;
+    previous_was_consonant = entry->leaves_consonant;
+    i += length;
+  }
+  return profile;
+}
+
+size_t profile_cache_lines(const key_profile &profile, double share, const keymap &keys)
+{
+  const key_automaton &automaton = keys.automaton();
+  unordered_map<uintptr_t, uint64_t> lines;
+  uint64_t total = 0;
+  auto read = [&](const void *data, size_t length, uint64_t count)
+  {
+    if (count == 0 || length == 0)
+    {
+      return;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(data);
+    for (uintptr_t line = start / 64; line <= (start + length - 1) / 64; ++line)
+    {
+      lines[line] += count;
+    }
+    total += count;
+  };
+  for (size_t slot = 0; slot < profile.transitions.size() && slot < automaton.node_count * automaton.class_count;
+       ++slot)
+  {
+    read(&automaton.transitions[slot], sizeof(uint16_t), profile.transitions[slot]);
+  }
+  for (size_t node = 0; node < profile.nodes.size() && node < automaton.node_count; ++node)
+  {
+    read(&automaton.accept[node], sizeof(uint16_t), profile.nodes[node]);
+  }
+  for (size_t i = 0; i < profile.outputs.size() && i / 2 < automaton.entry_count; ++i)
+  {
+    const key_entry &entry = automaton.entries[i / 2];
+    string_view output = key_output(automaton, entry, i % 2);
+    read(&entry, sizeof(entry), profile.outputs[i]);
+    read(output.data(), output.length(), profile.outputs[i]);
+  }
+
+  vector<uint64_t> counts;
+  counts.reserve(lines.size());
+  for (const auto &line : lines)
+  {
+    counts.push_back(line.second);
+  }
+  sort(counts.begin(), counts.end(), greater<uint64_t>());
+  // Each read counted once per line it touched, so the lines' sum can be
+  // a little over total; share is of total.
+  uint64_t needed = uint64_t(ceil(total * min(max(share, 0.0), 1.0)));
+  uint64_t served = 0;
+  size_t count = 0;
+  while (count < counts.size() && served < needed)
+  {
+    served += counts[count++];
+  }
+  return count;
+}
+
+namespace
+{
+
+// Orders indexes by falling weight, keeping the first fixed in place and
+// ties in their old order. Returns new index -> old index.
+vector<uint32_t> hot_first(const vector<uint64_t> &weights, size_t fixed)
+{
+  vector<uint32_t> order(weights.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin() + min(fixed, order.size()), order.end(),
+              [&](uint32_t a, uint32_t b) { return weights[a] > weights[b]; });
+  return order;
+}
+
+vector<uint32_t> ranks_of(const vector<uint32_t> &order)
+{
+  vector<uint32_t> ranks(order.size());
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    ranks[order[i]] = i;
+  }
+  return ranks;
+}
+
+} // namespace
+
+keymap keymap::reorder(const key_profile &profile) const
+{
+  const key_automaton &keys = automaton_;
+  size_t class_count = keys.class_count;
+  if (profile.transitions.size() != keys.node_count * class_count || profile.nodes.size() != keys.node_count ||
+      profile.outputs.size() != keys.entry_count * 2)
+  {
+    throw runtime_error("profile does not match the keymap");
+  }
+
+  vector<uint64_t> class_weights(class_count);
+  vector<uint64_t> node_weights(profile.nodes);
+  vector<uint64_t> entry_weights(keys.entry_count);
+  for (size_t node = 0; node < keys.node_count; ++node)
+  {
+    for (size_t c = 0; c < class_count; ++c)
+    {
+      uint64_t reads = profile.transitions[node * class_count + c];
+      class_weights[c] += reads;
+      node_weights[node] += reads;
+    }
+  }
+  for (size_t e = 0; e < keys.entry_count; ++e)
+  {
+    entry_weights[e] = profile.outputs[e * 2] + profile.outputs[e * 2 + 1];
+  }
+  // Class 0 (bytes in no key) and node 0 (the root, where a transition of 0
+  // means none) keep their numbers.
+  vector<uint32_t> class_order = hot_first(class_weights, 1);
+  vector<uint32_t> node_order = hot_first(node_weights, 1);
+  vector<uint32_t> entry_order = hot_first(entry_weights, 0);
+  vector<uint32_t> class_ranks = ranks_of(class_order);
+  vector<uint32_t> node_ranks = ranks_of(node_order);
+  vector<uint32_t> entry_ranks = ranks_of(entry_order);
+
+  // The pool is rewritten in entry order, so a hot entry's strings sit
+  // together near the front. An entry whose two outputs overlap or touch
+  // (one is usually the other plus or minus a vowel sign) is copied as one
+  // span to keep them shared. Entries of a loaded image may share spans
+  // with each other, which are copied once per entry, so the pool is sized
+  // from the spans rather than taken from keys.
+  auto span_of = [](const key_entry &entry, size_t &start, size_t &end)
+  {
+    start = min(entry.output_offset, entry.output_after_consonant_offset);
+    end = max(size_t(entry.output_offset) + entry.output_length,
+              size_t(entry.output_after_consonant_offset) + entry.output_after_consonant_length);
+    return end - start <= size_t(entry.output_length) + entry.output_after_consonant_length;
+  };
+  size_t new_pool_size = 0;
+  for (size_t e = 0; e < keys.entry_count; ++e)
+  {
+    const key_entry &entry = keys.entries[e];
+    size_t start, end;
+    new_pool_size += span_of(entry, start, end) ? end - start
+                                                : size_t(entry.output_length) + entry.output_after_consonant_length;
+  }
+  if (new_pool_size > UINT32_MAX)
+  {
+    throw runtime_error("layout is too large to compile");
+  }
+
+  compiled_offsets offsets = image_offsets(class_count, keys.node_count, keys.entry_count, new_pool_size);
+  auto image = make_shared<vector<char>>(offsets.size);
+  char *base = image->data();
+  unsigned char *byte_class = reinterpret_cast<unsigned char *>(base + offsets.byte_class);
+  uint16_t *transitions = reinterpret_cast<uint16_t *>(base + offsets.transitions);
+  uint16_t *accept = reinterpret_cast<uint16_t *>(base + offsets.accept);
+  key_entry *entries = reinterpret_cast<key_entry *>(base + offsets.entries);
+  char *pool = base + offsets.pool;
+
+  for (size_t b = 0; b < 256; ++b)
+  {
+    byte_class[b] = class_ranks[keys.byte_class[b]];
+  }
+  memcpy(base + offsets.start_low_nibble, keys.start_low_nibble, 16);
+  memcpy(base + offsets.start_high_nibble, keys.start_high_nibble, 16);
+  for (size_t node = 0; node < keys.node_count; ++node)
+  {
+    const uint16_t *row = &keys.transitions[node_order[node] * class_count];
+    for (size_t c = 0; c < class_count; ++c)
+    {
+      uint16_t target = row[class_order[c]];
+      transitions[node * class_count + c] = target == 0 ? 0 : node_ranks[target];
+    }
+    uint16_t entry = keys.accept[node_order[node]];
+    accept[node] = entry == 0 ? 0 : entry_ranks[entry - 1] + 1;
+  }
+
+  size_t pool_size = 0;
+  auto copy_output = [&](uint32_t offset, uint8_t length)
+  {
+    memcpy(pool + pool_size, keys.pool + offset, length);
+    pool_size += length;
+    return uint32_t(pool_size - length);
+  };
+  for (size_t e = 0; e < keys.entry_count; ++e)
+  {
+    key_entry entry = keys.entries[entry_order[e]];
+    size_t start, end;
+    if (span_of(entry, start, end))
+    {
+      memcpy(pool + pool_size, keys.pool + start, end - start);
+      entry.output_offset = pool_size + entry.output_offset - start;
+      entry.output_after_consonant_offset = pool_size + entry.output_after_consonant_offset - start;
+      pool_size += end - start;
+    }
+    else
+    {
+      entry.output_offset = copy_output(entry.output_offset, entry.output_length);
+      entry.output_after_consonant_offset =
+          copy_output(entry.output_after_consonant_offset, entry.output_after_consonant_length);
+    }
+    memcpy(&entries[e], &entry, sizeof(entry));
+  }
+
+  compiled_header header = {};
+  memcpy(header.magic, compiled_magic, sizeof(compiled_magic));
+  header.version = compiled_version;
+  header.byte_order = compiled_byte_order;
+  header.class_count = class_count;
+  header.node_count = keys.node_count;
+  header.entry_count = keys.entry_count;
+  header.pool_size = pool_size;
+  header.max_key_length = keys.max_key_length;
+  header.max_output_per_key_byte = keys.max_output_per_key_byte;
+  header.ascii_key_starts = keys.ascii_key_starts;
+  memcpy(base, &header, sizeof(header));
+  string_view view(image->data(), image->size());
+  return keymap(view_image(view.data(), view.size()), image, view);
+}
+
+namespace
+{
+
+template <class Input>
+void transliterate_items(const Input *inputs, size_t count, transliteration_batch &batch, const keymap &keys)
+{
+  size_t input_size = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    input_size += inputs[i].length();
+  }
+  // transliterated_size_bound() of all the inputs, so no item reallocates.
+  batch.data.reserve(batch.data.length() + input_size * keys.automaton().max_output_per_key_byte);
+  if (batch.offsets.empty())
+  {
+    batch.offsets.push_back(0);
+  }
+  batch.offsets.reserve(batch.offsets.size() + count);
+
+  string_sink sink = {batch.data};
+  for (size_t i = 0; i < count; ++i)
+  {
+    bool previous_was_consonant = false;
+    transliterate_into(keys.automaton(), inputs[i], sink, previous_was_consonant, true);
+    batch.offsets.push_back(batch.data.length());
+  }
+}
+
+} // namespace
+
+void transliterate_batch(const string_view *inputs, size_t count, transliteration_batch &batch, const keymap &keys)
+{
+  transliterate_items(inputs, count, batch, keys);
+}
+
+void transliterate_batch(const string *inputs, size_t count, transliteration_batch &batch, const keymap &keys)
+{
+  transliterate_items(inputs, count, batch, keys);
+}
+
+utf8_result transliterate_checked(string_view input, string &output, bool &previous_was_consonant, bool final,
+                                  utf8_policy policy, const keymap &keys)
+{
+  const key_automaton &automaton = keys.automaton();
+  string_sink sink = {output};
+  utf8_result result = {0, 0, string_view::npos};
+  if (!final)
+  {
+    input = input.substr(0, complete_utf8_length(input));
+  }
+  size_t pos = 0;
+  while (true)
+  {
+    string_view rest = input.substr(pos);
+    size_t valid = find_malformed_utf8(rest);
+    if (valid == rest.length())
+    {
+      result.consumed = pos + transliterate_into(automaton, rest, sink, previous_was_consonant, final);
+      return result;
+    }
+    // No key can run on into a malformed byte, so the valid part is
+    // transliterated as if it were the end of input.
+    transliterate_into(automaton, rest.substr(0, valid), sink, previous_was_consonant, true);
+    pos += valid;
+    result.malformed++;
+    if (result.first_malformed == string_view::npos)
+    {
+      result.first_malformed = pos;
+    }
+    if (policy == UTF8_REPORT)
+    {
+      result.consumed = pos;
+      return result;
+    }
+    sink.append("\xef\xbf\xbd", 3);
+    previous_was_consonant = false;
+    pos += utf8_sequence_at(input, pos).length;
+  }
+}
+
+preedit_edit transliteration_session::feed(char key)
+{
+  input_ += key;
+  return resolve_tail();
+}
+
+preedit_edit transliteration_session::backspace()
+{
+  if (input_.empty())
+  {
+    return {0, string_view()};
+  }
+  input_.pop_back();
+  while (!settled_.empty() && settled_.back().lookahead_end > input_.length())
+  {
+    settled_.pop_back();
+  }
+  return resolve_tail();
+}
+
+string transliteration_session::commit()
+{
+  string committed = move(output_);
+  reset();
+  return committed;
+}
+
+void transliteration_session::reset()
+{
+  input_.clear();
+  output_.clear();
+  settled_.clear();
+}
+
+preedit_edit transliteration_session::resolve_tail()
+{
+  checkpoint start = settled_.empty() ? checkpoint{0, 0, 0, false} : settled_.back();
+  bool previous_was_consonant = start.previous_was_consonant;
+  bool settling = true;
+
+  recorder record(true);
+  tail_.clear();
+  size_t i = start.input_end;
+  while (i < input_.length())
+  {
+    key_match match = match_in(keys_.automaton(), input_, i);
+    if (!starts_key(keys_.automaton(), input_[i]))
+    {
+      record.copied(1, true);
+    }
+    else
+    {
+      record.key(match);
+    }
+    if (match.length == 0)
+    {
+      tail_ += input_[i];
+      previous_was_consonant = false;
+      i += 1;
+    }
+    else
+    {
+      tail_ += key_output(keys_.automaton(), *match.entry, previous_was_consonant);
+      previous_was_consonant = match.entry->leaves_consonant;
+      i += match.length;
+    }
+    settling = settling && !match.open;
+    if (settling)
+    {
+      settled_.push_back({i, start.output_end + tail_.length(), i - max<size_t>(match.length, 1) + match.scanned,
+                          previous_was_consonant});
+    }
+  }
+
+  size_t old_length = output_.length() - start.output_end;
+  size_t common = 0;
+  while (common < old_length && common < tail_.length() &&
+         output_[start.output_end + common] == tail_[common])
+  {
+    ++common;
+  }
+  output_.resize(start.output_end + common);
+  output_.append(tail_, common, string::npos);
+  record.finish(i - start.input_end, tail_.length());
+  return {old_length - common, string_view(output_).substr(start.output_end + common)};
+}
+
+bool is_key_break(char c, const keymap &keys)
+{
+  return keys.automaton().byte_class[(unsigned char)c] == 0;
+}
+
+transliteration_pool::transliteration_pool(unsigned threads, const keymap &keys) : keys_(keys)
+{
+  for (unsigned i = 1; i < threads; ++i)
+  {
+    workers_.emplace_back([this] { work(); });
+  }
+}
+
+transliteration_pool::~transliteration_pool()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (thread &worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+size_t transliteration_pool::transliterate_block(string_view block, bool &previous_was_consonant, bool final)
+{
+  piece_count_ = 0;
+  size_t cut = block.length();
+  if (!final)
+  {
+    while (cut > 0 && !is_key_break(block[cut - 1], keys_))
+    {
+      --cut;
+    }
+    if (cut == 0)
+    {
+      // No break to cut at: settle what can be settled serially.
+      add_piece(block, previous_was_consonant);
+      return transliterate_chunk(block, pieces_[0].output, previous_was_consonant, false, keys_);
+    }
+  }
+  if (cut == 0)
+  {
+    return 0;
+  }
+
+  size_t target = max(cut / (thread_count() * pieces_per_thread), min_piece_size);
+  size_t start = 0;
+  while (start < cut)
+  {
+    size_t end = start + target;
+    while (end < cut && !is_key_break(block[end - 1], keys_))
+    {
+      ++end;
+    }
+    end = min(end, cut);
+    add_piece(block.substr(start, end - start), start == 0 ? previous_was_consonant : false);
+    start = end;
+  }
+  run_pieces();
+  previous_was_consonant = pieces_[piece_count_ - 1].previous_was_consonant;
+  return cut;
+}
+
+void transliteration_pool::transliterate(string_view input, string &output)
+{
+  bool previous_was_consonant = false;
+  transliterate_block(input, previous_was_consonant, true);
+  for (size_t i = 0; i < piece_count_; ++i)
+  {
+    output += pieces_[i].output;
+  }
+}
+
+void transliteration_pool::add_piece(string_view input, bool previous_was_consonant)
+{
+  if (piece_count_ == pieces_.size())
+  {
+    pieces_.emplace_back();
+  }
+  pieces_[piece_count_].input = input;
+  pieces_[piece_count_].previous_was_consonant = previous_was_consonant;
+  pieces_[piece_count_].output.clear();
+  ++piece_count_;
+}
+
+void transliteration_pool::run_pieces()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    next_piece_ = 0;
+    running_ = true;
+    ++generation_;
+  }
+  wake_.notify_all();
+  work_on_pieces();
+  unique_lock<mutex> lock(mutex_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  // Workers that wake from here on find the generation over and go back to
+  // sleep, so none can still be reading pieces_ when the next block fills it.
+  running_ = false;
+}
+
+void transliteration_pool::work_on_pieces()
+{
+  for (size_t index = next_piece_++; index < piece_count_; index = next_piece_++)
+  {
+    piece &current = pieces_[index];
+    if (cache_)
+    {
+      cache_->transliterate_chunk(current.input, current.output, current.previous_was_consonant, true);
+    }
+    else
+    {
+      transliterate_chunk(current.input, current.output, current.previous_was_consonant, true, keys_);
+    }
+  }
+}
+
+void transliteration_pool::work()
+{
+  size_t seen = 0;
+  while (true)
+  {
+    {
+      unique_lock<mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_)
+      {
+        return;
+      }
+      seen = generation_;
+      if (!running_)
+      {
+        continue;
+      }
+      ++busy_;
+    }
+    work_on_pieces();
+    {
+      lock_guard<mutex> lock(mutex_);
+      --busy_;
+    }
+    done_.notify_one();
+  }
+}
+
+word_table::word_table(size_t capacity)
+    : capacity_(min(max<size_t>(capacity, 1), max_capacity)), arena_limit_(capacity_ * arena_bytes_per_word)
+{
+  size_t slots = 2;
+  while (slots < capacity_ * 2)
+  {
+    slots *= 2;
+  }
+  current_.slots.assign(slots, 0);
+  previous_.slots.assign(slots, 0);
+}
+
+const word_table::entry *word_table::generation::find(string_view word, uint64_t hash) const
+{
+  for (size_t slot = hash & (slots.size() - 1); slots[slot] != 0; slot = (slot + 1) & (slots.size() - 1))
+  {
+    const entry &candidate = entries[slots[slot] - 1];
+    if (candidate.hash == hash && candidate.word_length == word.length() &&
+        memcmp(arena.data() + candidate.offset, word.data(), word.length()) == 0)
+    {
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+void word_table::generation::clear()
+{
+  fill(slots.begin(), slots.end(), 0);
+  entries.clear();
+  arena.clear();
+}
+
+bool word_table::lookup(string_view word, uint64_t hash, string &output, bool &ends_consonant)
+{
+  if (const entry *found = current_.find(word, hash))
+  {
+    output.append(current_.arena, found->offset + found->word_length, found->output_length);
+    ends_consonant = found->ends_consonant;
+    return true;
+  }
+  const entry *found = previous_.find(word, hash);
+  if (!found)
+  {
+    return false;
+  }
+  size_t start = output.length();
+  output.append(previous_.arena, found->offset + found->word_length, found->output_length);
+  ends_consonant = found->ends_consonant;
+  // found may not survive the insert, which can retire previous_.
+  insert(word, hash, string_view(output).substr(start), ends_consonant);
+  return true;
+}
+
+bool word_table::insert(string_view word, uint64_t hash, string_view output, bool ends_consonant)
+{
+  bool rotated = current_.entries.size() == capacity_ ||
+                 current_.arena.length() + word.length() + output.length() > arena_limit_;
+  if (rotated)
+  {
+    swap(current_, previous_);
+    current_.clear();
+  }
+  size_t slot = hash & (current_.slots.size() - 1);
+  while (current_.slots[slot] != 0)
+  {
+    slot = (slot + 1) & (current_.slots.size() - 1);
+  }
+  current_.slots[slot] = current_.entries.size() + 1;
+  current_.entries.push_back({hash, uint32_t(current_.arena.length()), uint16_t(output.length()),
+                              uint8_t(word.length()), ends_consonant});
+  current_.arena += word;
+  current_.arena += output;
+  return rotated;
+}
+
+void word_table::clear()
+{
+  current_.clear();
+  previous_.clear();
+}
+
+namespace
+{
+
+// Hashes a word 8 bytes at a time.
+uint64_t hash_word(string_view word)
+{
+  const uint64_t multiplier = 0x9e3779b97f4a7c15;
+  uint64_t hash = word.length() * multiplier;
+  size_t i = 0;
+  for (; i + 8 <= word.length(); i += 8)
+  {
+    uint64_t chunk;
+    memcpy(&chunk, word.data() + i, 8);
+    hash = (hash ^ chunk) * multiplier;
+    hash ^= hash >> 29;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, word.data() + i, word.length() - i);
+  hash = (hash ^ tail) * multiplier;
+  return hash ^ hash >> 32;
+}
+
+// transliterate_chunk() through a word cache. lookup and insert take the
+// word, its hash and the output, as word_table does.
+template <class Lookup, class Insert>
+size_t transliterate_words(const keymap &keys, string_view input, string &output, bool &previous_was_consonant,
+                           bool final, word_cache_stats &tally, Lookup &&lookup, Insert &&insert)
+{
+  const unsigned char *byte_class = keys.automaton().byte_class;
+  size_t i = 0;
+  while (i < input.length())
+  {
+    size_t end = i;
+    while (end < input.length() && byte_class[(unsigned char)input[end]] != 0)
+    {
+      ++end;
+    }
+    if (end == i)
+    {
+      while (end < input.length() && byte_class[(unsigned char)input[end]] == 0)
+      {
+        ++end;
+      }
+      output.append(input, i, end - i);
+      previous_was_consonant = false;
+      i = end;
+      continue;
+    }
+
+    string_view word = input.substr(i, end - i);
+    bool terminated = end < input.length() || final;
+    if (!terminated || previous_was_consonant || word.length() > max_cached_word_length)
+    {
+      tally.uncached++;
+      size_t consumed = khipro::transliterate_chunk(word, output, previous_was_consonant, terminated, keys);
+      i += consumed;
+      if (consumed < word.length())
+      {
+        break;
+      }
+      continue;
+    }
+
+    uint64_t hash = hash_word(word);
+    if (lookup(word, hash, output, previous_was_consonant))
+    {
+      tally.hits++;
+    }
+    else
+    {
+      tally.misses++;
+      size_t start = output.length();
+      khipro::transliterate_chunk(word, output, previous_was_consonant, true, keys);
+      if (insert(word, hash, string_view(output).substr(start), previous_was_consonant))
+      {
+        tally.generations++;
+      }
+    }
+    i = end;
+  }
+  return i;
+}
+
+} // namespace
+
+word_cache::word_cache(size_t capacity, const keymap &keys) : keys_(keys), table_(capacity)
+{
+}
+
+size_t word_cache::transliterate_chunk(string_view input, string &output, bool &previous_was_consonant, bool final)
+{
+  return transliterate_words(
+      keys_, input, output, previous_was_consonant, final, stats_,
+      [&](string_view word, uint64_t hash, string &out, bool &ends_consonant)
+      { return table_.lookup(word, hash, out, ends_consonant); },
+      [&](string_view word, uint64_t hash, string_view out, bool ends_consonant)
+      { return table_.insert(word, hash, out, ends_consonant); });
+}
+
+void word_cache::transliterate(string_view input, string &output)
+{
+  bool previous_was_consonant = false;
+  transliterate_chunk(input, output, previous_was_consonant, true);
+}
+
+void word_cache::clear()
+{
+  table_.clear();
+  stats_ = {};
+}
+
+// The tables of one concurrent_word_cache. Threads hold it weakly, so one
+// exiting after the cache is gone has nothing to hand back.
+struct concurrent_word_cache::tables
+{
+  explicit tables(size_t capacity) : capacity(capacity) {}
+
+  size_t capacity;
+  mutex held_mutex;
+  vector<unique_ptr<word_table>> held;
+};
+
+// The tables the current thread holds, handed back to their caches when it
+// exits.
+struct concurrent_word_cache::thread_tables
+{
+  struct slot
+  {
+    weak_ptr<tables> owner;
+    word_table *table;
+  };
+
+  ~thread_tables();
+
+  vector<slot> slots;
+};
+
+concurrent_word_cache::thread_tables::~thread_tables()
+{
+  for (const slot &held : slots)
+  {
+    if (shared_ptr<tables> owner = held.owner.lock())
+    {
+      lock_guard<mutex> lock(owner->held_mutex);
+      vector<unique_ptr<word_table>> &owned = owner->held;
+      owned.erase(find_if(owned.begin(), owned.end(),
+                          [&](const unique_ptr<word_table> &table) { return table.get() == held.table; }));
+    }
+  }
+}
+
+concurrent_word_cache::concurrent_word_cache(size_t capacity, const keymap &keys)
+    : keys_(keys), tables_(make_shared<tables>(capacity))
+{
+}
+
+word_table &concurrent_word_cache::thread_table()
+{
+  thread_local thread_tables local;
+  // Owner equivalence, unlike comparing addresses, cannot mistake a cache
+  // for a dead one whose memory it reuses.
+  for (const thread_tables::slot &held : local.slots)
+  {
+    if (!held.owner.owner_before(tables_) && !tables_.owner_before(held.owner))
+    {
+      return *held.table;
+    }
+  }
+  local.slots.erase(remove_if(local.slots.begin(), local.slots.end(),
+                              [](const thread_tables::slot &held) { return held.owner.expired(); }),
+                    local.slots.end());
+  lock_guard<mutex> lock(tables_->held_mutex);
+  tables_->held.push_back(make_unique<word_table>(tables_->capacity));
+  local.slots.push_back({tables_, tables_->held.back().get()});
+  return *tables_->held.back();
+}
+
+size_t concurrent_word_cache::transliterate_chunk(string_view input, string &output, bool &previous_was_consonant,
+                                                 bool final)
+{
+  word_table &table = thread_table();
+  word_cache_stats tally = {};
+  size_t consumed = transliterate_words(
+      keys_, input, output, previous_was_consonant, final, tally,
+      [&](string_view word, uint64_t hash, string &out, bool &ends_consonant)
+      { return table.lookup(word, hash, out, ends_consonant); },
+      [&](string_view word, uint64_t hash, string_view out, bool ends_consonant)
+      { return table.insert(word, hash, out, ends_consonant); });
+  hits_ += tally.hits;
+  misses_ += tally.misses;
+  uncached_ += tally.uncached;
+  generations_ += tally.generations;
+  return consumed;
+}
+
+void concurrent_word_cache::transliterate(string_view input, string &output)
+{
+  bool previous_was_consonant = false;
+  transliterate_chunk(input, output, previous_was_consonant, true);
+}
+
+word_cache_stats concurrent_word_cache::stats() const
+{
+  return {hits_.load(), misses_.load(), uncached_.load(), generations_.load()};
+}
+
+void concurrent_word_cache::clear()
+{
+  lock_guard<mutex> lock(tables_->held_mutex);
+  for (const unique_ptr<word_table> &table : tables_->held)
+  {
+    table->clear();
+  }
+  hits_ = 0;
+  misses_ = 0;
+  uncached_ = 0;
+  generations_ = 0;
+}
+
+reverse_transliterator::reverse_transliterator(const keymap &keys) : keys_(keys)
+{
+  const key_automaton &automaton = keys_.automaton();
+  size_t classes = automaton.class_count;
+
+  // Recover every entry's key by walking the automaton.
+  unsigned char class_byte[256] = {};
+  for (size_t c = 0; c < 256; ++c)
+  {
+    class_byte[automaton.byte_class[c]] = c;
+  }
+  entry_keys_.resize(automaton.entry_count);
+  entry_nodes_.resize(automaton.entry_count);
+  has_children_.resize(automaton.node_count);
+  vector<pair<size_t, string>> pending = {{0, string()}};
+  while (!pending.empty())
+  {
+    pair<size_t, string> current = move(pending.back());
+    pending.pop_back();
+    for (size_t c = 1; c < classes; ++c)
+    {
+      size_t child = automaton.transitions[current.first * classes + c];
+      if (child == 0)
+      {
+        continue;
+      }
+      has_children_[current.first] = true;
+      string key = current.second + char(class_byte[c]);
+      if (automaton.accept[child] != 0)
+      {
+        entry_keys_[automaton.accept[child] - 1] = key;
+        entry_nodes_[automaton.accept[child] - 1] = child;
+      }
+      pending.emplace_back(child, move(key));
+    }
+  }
+
+  // Trie over the outputs, with the entries emitting each output (and in
+  // which consonant state) listed at its node.
+  bool output_byte[256] = {};
+  for (size_t e = 0; e < automaton.entry_count; ++e)
+  {
+    for (bool previous_was_consonant : {false, true})
+    {
+      for (char c : key_output(automaton, automaton.entries[e], previous_was_consonant))
+      {
+        output_byte[(unsigned char)c] = true;
+      }
+    }
+  }
+  output_class_count_ = 1;
+  for (size_t c = 0; c < 256; ++c)
+  {
+    output_class_[c] = output_byte[c] ? output_class_count_++ : 0;
+    word_break_[c] = automaton.byte_class[c] == 0 && !output_byte[c];
+  }
+
+  output_transitions_.assign(output_class_count_, 0);
+  vector<pair<uint32_t, output_terminal>> node_terminals;
+  for (size_t e = 0; e < automaton.entry_count; ++e)
+  {
+    for (bool previous_was_consonant : {false, true})
+    {
+      string_view output = key_output(automaton, automaton.entries[e], previous_was_consonant);
+      if (output.empty())
+      {
+        empty_outputs_[previous_was_consonant].push_back(e);
+        continue;
+      }
+      size_t node = 0;
+      for (char c : output)
+      {
+        size_t slot = node * output_class_count_ + output_class_[(unsigned char)c];
+        if (output_transitions_[slot] == 0)
+        {
+          output_transitions_[slot] = output_transitions_.size() / output_class_count_;
+          output_transitions_.resize(output_transitions_.size() + output_class_count_);
+        }
+        node = output_transitions_[slot];
+      }
+      node_terminals.push_back({uint32_t(node), {uint16_t(e), previous_was_consonant}});
+    }
+  }
+  stable_sort(node_terminals.begin(), node_terminals.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+  terminal_begin_.assign(output_transitions_.size() / output_class_count_ + 1, 0);
+  shortest_key_.assign(terminal_begin_.size() - 1, UINT32_MAX);
+  for (const auto &terminal : node_terminals)
+  {
+    terminal_begin_[terminal.first + 1]++;
+    terminals_.push_back(terminal.second);
+    shortest_key_[terminal.first] =
+        min<uint32_t>(shortest_key_[terminal.first], entry_keys_[terminal.second.entry].length());
+  }
+  for (size_t i = 1; i < terminal_begin_.size(); ++i)
+  {
+    terminal_begin_[i] += terminal_begin_[i - 1];
+  }
+}
+
+bool reverse_transliterator::transliterate_back(string_view text, string &keys)
+{
+  size_t original_length = keys.length();
+  size_t start = 0;
+  for (size_t i = 0; i <= text.length(); ++i)
+  {
+    if (i < text.length() && !word_break_[(unsigned char)text[i]])
+    {
+      continue;
+    }
+    // A word break is typed as itself, and no walk or consonant state
+    // survives it, so every word is searched on its own.
+    if (!search_word(text.substr(start, i - start), keys))
+    {
+      keys.resize(original_length);
+      return false;
+    }
+    if (i < text.length())
+    {
+      keys += text[i];
+    }
+    start = i + 1;
+  }
+  return true;
+}
+
+bool reverse_transliterator::search_word(string_view word, string &keys)
+{
+  const key_automaton &automaton = keys_.automaton();
+  states_.clear();
+  live_.clear();
+  queue_.clear();
+  position_states_.assign(word.length() + 1, no_state);
+
+  // A* on the cheapest cost of the rest of the word when consonant state
+  // and live walks are ignored. That never overestimates and is consistent,
+  // so settled states stay final.
+  remaining_cost_.assign(word.length() + 1, UINT32_MAX);
+  remaining_cost_[word.length()] = 0;
+  for (size_t position = word.length(); position-- > 0;)
+  {
+    uint32_t &best = remaining_cost_[position];
+    unsigned char c = word[position];
+    size_t byte_node = automaton.transitions[automaton.byte_class[c]];
+    if ((byte_node == 0 || automaton.accept[byte_node] == 0) && remaining_cost_[position + 1] != UINT32_MAX)
+    {
+      best = remaining_cost_[position + 1] + (c < 0x80 ? 1 : untypeable_byte_cost);
+    }
+    size_t node = 0;
+    for (size_t i = position; i < word.length(); ++i)
+    {
+      node = output_transitions_[node * output_class_count_ + output_class_[(unsigned char)word[i]]];
+      if (node == 0)
+      {
+        break;
+      }
+      if (terminal_begin_[node] != terminal_begin_[node + 1] && remaining_cost_[i + 1] != UINT32_MAX)
+      {
+        best = min(best, remaining_cost_[i + 1] + shortest_key_[node]);
+      }
+    }
+  }
+  if (remaining_cost_[0] == UINT32_MAX)
+  {
+    return false;
+  }
+
+  next_live_.clear();
+  uint32_t start = intern(0, false);
+  states_[start].cost = 0;
+  queue_.push_back({remaining_cost_[0], start});
+
+  while (!queue_.empty())
+  {
+    pop_heap(queue_.begin(), queue_.end(), greater<>());
+    uint32_t index = queue_.back().second;
+    queue_.pop_back();
+    if (states_[index].settled)
+    {
+      continue;
+    }
+    states_[index].settled = true;
+    state current = states_[index];
+    if (current.position == word.length())
+    {
+      path_.clear();
+      for (uint32_t i = index; states_[i].parent != no_state; i = states_[i].parent)
+      {
+        path_.push_back(states_[i].token);
+      }
+      for (size_t i = path_.size(); i-- > 0;)
+      {
+        if (path_[i] >= pass_through_token)
+        {
+          keys += char(path_[i] - pass_through_token);
+        }
+        else
+        {
+          keys += entry_keys_[path_[i]];
+        }
+      }
+      return true;
+    }
+
+    // Keys whose output continues the word here.
+    size_t node = 0;
+    for (size_t i = current.position; i < word.length(); ++i)
+    {
+      node = output_transitions_[node * output_class_count_ + output_class_[(unsigned char)word[i]]];
+      if (node == 0)
+      {
+        break;
+      }
+      for (size_t t = terminal_begin_[node]; t < terminal_begin_[node + 1]; ++t)
+      {
+        const output_terminal &terminal = terminals_[t];
+        if (terminal.previous_was_consonant == current.previous_was_consonant)
+        {
+          const string &key = entry_keys_[terminal.entry];
+          relax(index, key, terminal.entry, entry_nodes_[terminal.entry], i + 1,
+                automaton.entries[terminal.entry].leaves_consonant, current.cost + key.length());
+        }
+      }
+    }
+    for (uint16_t entry : empty_outputs_[current.previous_was_consonant])
+    {
+      const string &key = entry_keys_[entry];
+      relax(index, key, entry, entry_nodes_[entry], current.position, automaton.entries[entry].leaves_consonant,
+            current.cost + key.length());
+    }
+
+    // The byte itself, which passes through if no key matches there.
+    unsigned char c = word[current.position];
+    size_t byte_node = automaton.transitions[automaton.byte_class[c]];
+    if (byte_node == 0 || automaton.accept[byte_node] == 0)
+    {
+      relax(index, word.substr(current.position, 1), pass_through_token + c, byte_node, current.position + 1, false,
+            current.cost + (c < 0x80 ? 1 : untypeable_byte_cost));
+    }
+  }
+  return false;
+}
+
+// Follows a key (or pass-through byte) from state from. Every live walk must
+// die inside it without reaching a longer key, or else the longest match
+// would not split the keys this way; walks still alive after it stay live,
+// and so does the walk the key itself starts.
+void reverse_transliterator::relax(uint32_t from, string_view token_bytes, uint32_t token, size_t token_node,
+                                   uint32_t position, bool previous_was_consonant, uint32_t cost)
+{
+  const key_automaton &automaton = keys_.automaton();
+  next_live_.clear();
+  const state &source = states_[from];
+  for (size_t i = 0; i < source.live_count; ++i)
+  {
+    size_t node = live_[source.live_offset + i];
+    for (char c : token_bytes)
+    {
+      node = automaton.transitions[node * automaton.class_count + automaton.byte_class[(unsigned char)c]];
+      if (node == 0)
+      {
+        break;
+      }
+      if (automaton.accept[node] != 0)
+      {
+        return;
+      }
+    }
+    if (node != 0)
+    {
+      next_live_.push_back(node);
+    }
+  }
+  if (token_node != 0 && has_children_[token_node])
+  {
+    next_live_.push_back(token_node);
+  }
+
+  uint32_t index = intern(position, previous_was_consonant);
+  state &target = states_[index];
+  if (!target.settled && cost < target.cost && remaining_cost_[position] != UINT32_MAX)
+  {
+    target.cost = cost;
+    target.parent = from;
+    target.token = token;
+    queue_.push_back({cost + remaining_cost_[position], index});
+    push_heap(queue_.begin(), queue_.end(), greater<>());
+  }
+}
+
+// Finds or adds the state at position with next_live_ as its live walks.
+uint32_t reverse_transliterator::intern(uint32_t position, bool previous_was_consonant)
+{
+  for (uint32_t i = position_states_[position]; i != no_state; i = states_[i].next)
+  {
+    const state &candidate = states_[i];
+    if (candidate.previous_was_consonant == previous_was_consonant && candidate.live_count == next_live_.size() &&
+        equal(next_live_.begin(), next_live_.end(), live_.begin() + candidate.live_offset))
+    {
+      return i;
+    }
+  }
+  states_.push_back({position, uint32_t(live_.size()), UINT32_MAX, no_state, 0, position_states_[position],
+                     uint16_t(next_live_.size()), previous_was_consonant, false});
+  live_.insert(live_.end(), next_live_.begin(), next_live_.end());
+  position_states_[position] = states_.size() - 1;
+  return states_.size() - 1;
+}
+
+struct language_model::tables
+{
+  unordered_map<string, uint32_t> ids;
+  vector<float> unigram_costs;
+  vector<bool> has_bigrams;
+  unordered_map<uint64_t, float> bigram_costs;
+  float unknown_cost;
+  float backoff_penalty;
+};
+
+language_model language_model::parse(string_view text)
+{
+  // Weight of the bigram estimate where the previous token has any.
+  const double bigram_weight = 0.8;
+
+  auto model = make_shared<tables>();
+  vector<uint64_t> unigram_counts = {0};
+  vector<uint64_t> context_counts = {0};
+  // Keyed by previous << 32 | token, so repeated lines add up like unigrams.
+  unordered_map<uint64_t, uint64_t> bigram_counts;
+  model->ids.emplace("", word_start);
+  auto id_of = [&](string_view token)
+  {
+    auto inserted = model->ids.emplace(string(token), model->ids.size());
+    if (inserted.second)
+    {
+      unigram_counts.push_back(0);
+      context_counts.push_back(0);
+    }
+    return inserted.first->second;
+  };
+
+  uint64_t total = 0;
+  size_t line_number = 0;
+  size_t line_start = 0;
+  while (line_start < text.length())
+  {
+    size_t line_end = min(text.find('\n', line_start), text.length());
+    string_view line = text.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+    ++line_number;
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+
+    vector<string_view> fields;
+    for (size_t start = 0;;)
+    {
+      size_t tab = line.find('\t', start);
+      fields.push_back(line.substr(start, tab - start));
+      if (tab == string_view::npos)
+      {
+        break;
+      }
+      start = tab + 1;
+    }
+    uint64_t count = 0;
+    bool numeric = !fields[0].empty() && fields[0].length() < 20;
+    for (char c : fields[0])
+    {
+      numeric = numeric && isdigit((unsigned char)c);
+      count = count * 10 + (c - '0');
+    }
+    if (!numeric || fields.size() < 2 || fields.size() > 3 || fields.back().empty())
+    {
+      throw runtime_error("model line " + to_string(line_number) + ": expected count<TAB>[previous<TAB>]token");
+    }
+
+    if (fields.size() == 2)
+    {
+      unigram_counts[id_of(fields[1])] += count;
+      total += count;
+    }
+    else
+    {
+      uint32_t previous = id_of(fields[1]);
+      uint32_t token = id_of(fields[2]);
+      bigram_counts[uint64_t(previous) << 32 | token] += count;
+      context_counts[previous] += count;
+    }
+  }
+
+  double denominator = double(total) + model->ids.size();
+  model->unknown_cost = -log(1 / denominator);
+  model->backoff_penalty = -log(1 - bigram_weight);
+  for (uint64_t count : unigram_counts)
+  {
+    model->unigram_costs.push_back(-log((count + 1) / denominator));
+  }
+  for (uint64_t count : context_counts)
+  {
+    model->has_bigrams.push_back(count != 0);
+  }
+  for (const auto &bigram : bigram_counts)
+  {
+    uint32_t previous = bigram.first >> 32;
+    uint32_t token = uint32_t(bigram.first);
+    if (context_counts[previous] == 0)
+    {
+      continue;
+    }
+    double probability = bigram_weight * bigram.second / context_counts[previous] +
+                         (1 - bigram_weight) * (unigram_counts[token] + 1) / denominator;
+    model->bigram_costs[bigram.first] = -log(probability);
+  }
+
+  language_model result;
+  result.tables_ = model;
+  return result;
+}
+
+language_model language_model::load(const string &path)
+{
+  ifstream file(path, ios::binary);
+  if (!file)
+  {
+    throw runtime_error(path + ": " + strerror(errno));
+  }
+  string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  try
+  {
+    return parse(text);
+  }
+  catch (const runtime_error &error)
+  {
+    throw runtime_error(path + ": " + error.what());
+  }
+}
+
+uint32_t language_model::token_id(string_view token) const
+{
+  if (!tables_ || token.empty())
+  {
+    return unknown;
+  }
+  auto found = tables_->ids.find(string(token));
+  return found == tables_->ids.end() ? unknown : found->second;
+}
+
+float language_model::cost(uint32_t previous, uint32_t token) const
+{
+  const tables &model = *tables_;
+  float unigram = token == unknown ? model.unknown_cost : model.unigram_costs[token];
+  if (previous == unknown || !model.has_bigrams[previous])
+  {
+    return unigram;
+  }
+  if (token != unknown)
+  {
+    auto found = model.bigram_costs.find(uint64_t(previous) << 32 | token);
+    if (found != model.bigram_costs.end())
+    {
+      return found->second;
+    }
+  }
+  return unigram + model.backoff_penalty;
+}
+
+suggestion_engine::suggestion_engine(const keymap &keys, language_model model, size_t beam_width)
+    : keys_(keys), model_(move(model)), beam_width_(max<size_t>(beam_width, 1))
+{
+  const key_automaton &automaton = keys_.automaton();
+  for (size_t e = 0; e < automaton.entry_count; ++e)
+  {
+    for (bool previous_was_consonant : {false, true})
+    {
+      entry_token_ids_.push_back(model_.token_id(key_output(automaton, automaton.entries[e], previous_was_consonant)));
+    }
+  }
+  for (size_t c = 0; c < 256; ++c)
+  {
+    char byte = c;
+    byte_token_ids_[c] = model_.token_id(string_view(&byte, 1));
+  }
+  reset();
+}
+
+void suggestion_engine::feed(char key)
+{
+  input_ += key;
+  extend();
+}
+
+void suggestion_engine::backspace()
+{
+  if (input_.empty())
+  {
+    return;
+  }
+  input_.pop_back();
+  beam_begin_.pop_back();
+  hypotheses_.resize(beam_begin_.back());
+}
+
+void suggestion_engine::reset()
+{
+  const uint64_t fnv_offset = 0xcbf29ce484222325;
+  input_.clear();
+  hypotheses_.assign(1, {no_parent, 0, 0, language_model::word_start, fnv_offset, 0, false});
+  beam_begin_.assign({0, 1});
+}
+
+void suggestion_engine::set_input(string_view input)
+{
+  size_t common = 0;
+  while (common < input.length() && common < input_.length() && input[common] == input_[common])
+  {
+    ++common;
+  }
+  while (input_.length() > common)
+  {
+    backspace();
+  }
+  for (char key : input.substr(common))
+  {
+    feed(key);
+  }
+}
+
+// Builds the beam at the end of the input from every token ending there:
+// the key input_[p, end) for each earlier position p, or the last byte if
+// no key is that byte alone.
+void suggestion_engine::extend()
+{
+  const uint64_t fnv_prime = 0x100000001b3;
+  const key_automaton &automaton = keys_.automaton();
+  size_t end = input_.length();
+  candidates_.clear();
+
+  for (size_t p = end > automaton.max_key_length ? end - automaton.max_key_length : 0; p < end; ++p)
+  {
+    if (beam_begin_[p] == beam_begin_[p + 1])
+    {
+      continue;
+    }
+    size_t node = 0;
+    for (size_t i = p; i < end && (i == p || node != 0); ++i)
+    {
+      node = automaton.transitions[node * automaton.class_count + automaton.byte_class[(unsigned char)input_[i]]];
+    }
+    uint32_t token;
+    if (node != 0 && automaton.accept[node] != 0)
+    {
+      token = automaton.accept[node] - 1;
+    }
+    else if (p + 1 == end)
+    {
+      token = pass_through_token + (unsigned char)input_[p];
+    }
+    else
+    {
+      continue;
+    }
+
+    for (uint32_t index = beam_begin_[p]; index < beam_begin_[p + 1]; ++index)
+    {
+      const hypothesis &previous = hypotheses_[index];
+      hypothesis next;
+      next.parent = index;
+      next.start = p;
+      next.token = token;
+      uint32_t id = token >= pass_through_token ? byte_token_ids_[token - pass_through_token]
+                                                : entry_token_ids_[token * 2 + previous.previous_was_consonant];
+      next.context = model_.empty() ? language_model::word_start : id;
+      next.cost = previous.cost + token_cost(previous.context, id);
+      next.previous_was_consonant = token < pass_through_token && automaton.entries[token].leaves_consonant;
+      next.output_hash = previous.output_hash;
+      for (char c : token_output(token, p, previous.previous_was_consonant))
+      {
+        next.output_hash = (next.output_hash ^ (unsigned char)c) * fnv_prime;
+      }
+      candidates_.push_back(next);
+    }
+  }
+
+  // Paths that agree on output, consonant state and model context have the
+  // same future; keep the cheapest of each, then the cheapest beam_width_.
+  sort(candidates_.begin(), candidates_.end(), [](const hypothesis &a, const hypothesis &b)
+       {
+         return tie(a.output_hash, a.previous_was_consonant, a.context, a.cost, b.start) <
+                tie(b.output_hash, b.previous_was_consonant, b.context, b.cost, a.start);
+       });
+  candidates_.erase(unique(candidates_.begin(), candidates_.end(), [](const hypothesis &a, const hypothesis &b)
+                           {
+                             return a.output_hash == b.output_hash &&
+                                    a.previous_was_consonant == b.previous_was_consonant && a.context == b.context;
+                           }),
+                    candidates_.end());
+  sort(candidates_.begin(), candidates_.end(), [](const hypothesis &a, const hypothesis &b)
+       { return tie(a.cost, b.start, a.output_hash) < tie(b.cost, a.start, b.output_hash); });
+  candidates_.resize(min(candidates_.size(), beam_width_));
+  hypotheses_.insert(hypotheses_.end(), candidates_.begin(), candidates_.end());
+  beam_begin_.push_back(hypotheses_.size());
+}
+
+float suggestion_engine::token_cost(uint32_t context, uint32_t token_id) const
+{
+  return model_.empty() ? 1 : model_.cost(context, token_id);
+}
+
+string_view suggestion_engine::token_output(uint32_t token, uint32_t start, bool previous_was_consonant) const
+{
+  if (token >= pass_through_token)
+  {
+    return string_view(input_).substr(start, 1);
+  }
+  const key_automaton &automaton = keys_.automaton();
+  return key_output(automaton, automaton.entries[token], previous_was_consonant);
+}
+
+void suggestion_engine::path_output(uint32_t index, string &output)
+{
+  path_.clear();
+  for (; hypotheses_[index].parent != no_parent; index = hypotheses_[index].parent)
+  {
+    path_.push_back(index);
+  }
+  for (size_t i = path_.size(); i-- > 0;)
+  {
+    const hypothesis &current = hypotheses_[path_[i]];
+    output += token_output(current.token, current.start, hypotheses_[current.parent].previous_was_consonant);
+  }
+}
+
+const vector<suggestion> &suggestion_engine::suggest(size_t count)
+{
+  suggestions_.clear();
+  if (input_.empty() || count == 0)
+  {
+    return suggestions_;
+  }
+
+  // The transliterate() output, costed along its own path.
+  const key_automaton &automaton = keys_.automaton();
+  suggestion greedy = {string(), 0};
+  bool previous_was_consonant = false;
+  uint32_t context = language_model::word_start;
+  for (size_t i = 0; i < input_.length();)
+  {
+    key_match match = match_in(automaton, input_, i);
+    uint32_t token = match.length == 0 ? pass_through_token + (unsigned char)input_[i] : match.entry - automaton.entries;
+    uint32_t id = token >= pass_through_token ? byte_token_ids_[token - pass_through_token]
+                                              : entry_token_ids_[token * 2 + previous_was_consonant];
+    greedy.text += token_output(token, i, previous_was_consonant);
+    greedy.cost += token_cost(context, id);
+    context = model_.empty() ? language_model::word_start : id;
+    previous_was_consonant = match.length != 0 && match.entry->leaves_consonant;
+    i += max<size_t>(match.length, 1);
+  }
+  suggestions_.push_back(move(greedy));
+
+  string text;
+  for (uint32_t index = beam_begin_[input_.length()];
+       index < beam_begin_[input_.length() + 1] && suggestions_.size() < count; ++index)
+  {
+    text.clear();
+    path_output(index, text);
+    if (none_of(suggestions_.begin(), suggestions_.end(), [&](const suggestion &s) { return s.text == text; }))
+    {
+      suggestions_.push_back({text, hypotheses_[index].cost});
+    }
+  }
+  return suggestions_;
+}
+
+} // namespace khipro
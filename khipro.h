@@ -0,0 +1,743 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef KHIPRO_H
+#define KHIPRO_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace khipro
+{
+
+struct key_mapping
+{
+  std::string_view key;
+  std::string_view value;
+};
+
+// Categories in the priority order keys resolve in: a key present in
+// several maps takes the category of the first one.
+enum token_category : uint8_t
+{
+  TOKEN_CONJUNCT,
+  TOKEN_CONSONANT,
+  TOKEN_DIACRITIC,
+  TOKEN_REPH,
+  TOKEN_PUNCTUATION,
+  TOKEN_PHOLA,
+  TOKEN_VOWEL,
+  TOKEN_VOWEL_SIGN,
+  TOKEN_DIGIT
+};
+
+struct key_map_ref
+{
+  const key_mapping *mappings;
+  size_t size;
+  token_category category;
+};
+
+// The layout's nine maps, indexed by token_category.
+constexpr size_t key_map_count = 9;
+extern const key_map_ref key_maps[key_map_count];
+
+extern const int max_token_length;
+
+// Everything transliterate() needs to emit a key: the text written after a
+// non-consonant, the text written right after a consonant (vowel signs,
+// hasanta + phola), and the resulting consonant state. Outputs are offsets
+// into the automaton's string pool.
+struct key_entry
+{
+  uint32_t output_offset;
+  uint32_t output_after_consonant_offset;
+  uint8_t output_length;
+  uint8_t output_after_consonant_length;
+  token_category category;
+  bool leaves_consonant;
+};
+
+// Longest-match automaton over the keys of every map of a layout. Node 0 is
+// the root; each node owns a row of class_count transitions indexed by
+// byte_class, where 0 means "no transition" (nothing ever returns to the
+// root). Bytes that appear in no key share class 0, so their column is
+// always empty. accept holds the node's entry index + 1, or 0 if no key ends
+// there. start_low_nibble/start_high_nibble classify key-start bytes 16 or
+// 32 at a time: a byte starts a key iff the entries for its two nibbles share
+// a bit. That only works for ASCII, so ascii_key_starts says whether the
+// tables are usable. No key emits more than max_output_per_key_byte output
+// bytes per key byte.
+struct key_automaton
+{
+  const unsigned char *byte_class;
+  size_t class_count;
+  const uint16_t *transitions;
+  const uint16_t *accept;
+  const key_entry *entries;
+  const char *pool;
+  size_t max_key_length;
+  const unsigned char *start_low_nibble;
+  const unsigned char *start_high_nibble;
+  bool ascii_key_starts;
+  size_t max_output_per_key_byte;
+  size_t node_count;
+  size_t entry_count;
+  size_t pool_size;
+};
+
+// How often a run over some text read each part of a keymap's tables, as
+// counted by profile_keys(). transitions is indexed like
+// key_automaton::transitions, nodes counts arrivals at each node (reads of
+// its accept slot), and outputs counts output reads at entry * 2 +
+// previous_was_consonant.
+struct key_profile
+{
+  std::vector<uint64_t> transitions;
+  std::vector<uint64_t> nodes;
+  std::vector<uint64_t> outputs;
+};
+
+// A compiled layout. The built-in one is compiled into the library; others
+// are compiled at run time from the text layout format, or loaded from a
+// compiled image written by save_compiled(), which is mapped and used in
+// place (or read, from a pipe). Copies share the tables.
+//
+// The text format has one section per map, headed by its name ("[vowels]",
+// "vowels_map = {" or "(vowels"), followed by quoted key/value pairs, on
+// the heading's line or the lines after it, so the dictionaries of the
+// Python sources can be used as is. "#" and ";" start comments. Values are
+// at most 255 bytes (252 for phola, which gets a hasanta in front). As in
+// the built-in layout, the first occurrence of a key in the map order of
+// token_category wins.
+class keymap
+{
+public:
+  static const keymap &builtin();
+
+  // Compiles maps, indexed by token_category.
+  static keymap compile(const key_map_ref *maps);
+
+  // Parses and compiles a text layout; throws std::runtime_error on errors.
+  static keymap from_layout(std::string_view text);
+
+  // Loads a compiled image or, failing the magic check, a text layout.
+  // Throws std::runtime_error if the file cannot be read or is invalid.
+  static keymap load(const std::string &path);
+
+  void save_compiled(const std::string &path) const;
+
+  // The same keymap with its tables renumbered hot-first for profile (taken
+  // on this keymap): byte classes by how often they are read, so the hot
+  // columns of a row share its first cache line; nodes by how often their
+  // rows are read; entries, and the strings they output, by use. Whatever
+  // profile never touched (most of the long conjuncts) ends up at the back
+  // of each table. Output is unchanged; throws std::runtime_error if the
+  // profile's sizes do not match.
+  keymap reorder(const key_profile &profile) const;
+
+  const key_automaton &automaton() const { return automaton_; }
+  size_t max_key_length() const { return automaton_.max_key_length; }
+
+private:
+  keymap(const key_automaton &automaton, std::shared_ptr<const void> storage, std::string_view image)
+      : automaton_(automaton), storage_(std::move(storage)), image_(image)
+  {
+  }
+
+  key_automaton automaton_;
+  std::shared_ptr<const void> storage_;
+  std::string_view image_;
+};
+
+// Transliterates text with keys, discarding the output, and counts the
+// table reads it makes.
+key_profile profile_keys(std::string_view text, const keymap &keys = keymap::builtin());
+
+// The fewest 64-byte lines of keys' tables that serve share (0 to 1) of the
+// reads counted in profile, which must have been taken on keys: how much of
+// the tables has to stay cached for the run profile measured. Lines are
+// those of the tables' actual addresses.
+size_t profile_cache_lines(const key_profile &profile, double share, const keymap &keys = keymap::builtin());
+
+// Writes maps in the text layout format.
+std::string format_layout(const key_map_ref *maps = key_maps);
+
+struct key_match
+{
+  size_t length;
+  const key_entry *entry;
+  size_t scanned;
+  bool open;
+};
+
+// Walks the automaton from text[pos]. length is the longest key found there
+// (0 if none) and entry that key's data. scanned counts the bytes the walk
+// read, including the one that stopped it; open is set when the walk ran off
+// the end of text while a longer key could still follow.
+key_match match_key(std::string_view text, size_t pos, const keymap &keys = keymap::builtin());
+
+// Bytes that occur in no key. No match can span one and the consonant state
+// is always clear after one, so input can be cut right after it.
+bool is_key_break(char c, const keymap &keys = keymap::builtin());
+
+// Splits text into keys. Input no key matches comes out one code point per
+// token (one byte per token where it is not well-formed UTF-8).
+std::vector<std::string> tokenize(std::string_view text, const keymap &keys = keymap::builtin());
+
+// Transliterates input onto the end of output and returns how many bytes
+// were consumed. Unless final is set, a trailing key that more input could
+// still extend is left unconsumed so the caller can resubmit it with the
+// next chunk; previous_was_consonant carries the state across calls.
+size_t transliterate_chunk(std::string_view input, std::string &output, bool &previous_was_consonant, bool final,
+                           const keymap &keys = keymap::builtin());
+
+// Appends the transliteration of input to output, so callers can reuse one
+// buffer across calls.
+void transliterate(std::string_view input, std::string &output, const keymap &keys = keymap::builtin());
+
+std::string transliterate(std::string_view input, const keymap &keys = keymap::builtin());
+
+// Writes the transliteration of input to buffer and returns its full length.
+// Like snprintf, output beyond capacity is dropped (and nothing is NUL
+// terminated), so a result larger than capacity means it was truncated.
+size_t transliterate(std::string_view input, char *buffer, size_t capacity,
+                   const keymap &keys = keymap::builtin());
+
+// Upper bound on the transliterated length of input, for preallocating.
+size_t transliterated_size_bound(std::string_view input, const keymap &keys = keymap::builtin());
+
+// Outputs of a batch, laid out like an Arrow string column: item i is
+// data[offsets[i], offsets[i + 1]). Reusing one batch across calls reuses
+// its buffers.
+struct transliteration_batch
+{
+  std::string data;
+  std::vector<size_t> offsets;
+
+  size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+  std::string_view operator[](size_t index) const
+  {
+    return std::string_view(data).substr(offsets[index], offsets[index + 1] - offsets[index]);
+  }
+
+  void clear()
+  {
+    data.clear();
+    offsets.clear();
+  }
+};
+
+// Transliterates each of count inputs on its own, appending the outputs to
+// batch. For many short strings this avoids the per-call allocations of
+// transliterate().
+void transliterate_batch(const std::string_view *inputs, size_t count, transliteration_batch &batch,
+                         const keymap &keys = keymap::builtin());
+void transliterate_batch(const std::string *inputs, size_t count, transliteration_batch &batch,
+                         const keymap &keys = keymap::builtin());
+
+// Offset of the first byte of text that is not part of well-formed UTF-8
+// (no overlong forms, surrogates or code points past U+10FFFF), or
+// text.length() if there is none. Vectorized where the CPU allows.
+size_t find_malformed_utf8(std::string_view text);
+
+// Length of text without a final sequence that more bytes could still
+// complete, for cutting a stream on code point boundaries.
+size_t complete_utf8_length(std::string_view text);
+
+// What transliterate_checked() does with input that is not well-formed
+// UTF-8.
+enum utf8_policy : uint8_t
+{
+  // Stop before the first malformed sequence.
+  UTF8_REPORT,
+  // Write U+FFFD in place of each maximal malformed subpart, as section 3.9
+  // of the Unicode standard recommends.
+  UTF8_REPLACE,
+};
+
+struct utf8_result
+{
+  size_t consumed;
+  // Malformed sequences met; at most one under UTF8_REPORT.
+  size_t malformed;
+  // Offset in input of the first one, or npos.
+  size_t first_malformed;
+};
+
+// transliterate_chunk() for untrusted input, which is checked to be
+// well-formed UTF-8 first. Unless final, a code point cut off at the end of
+// input is left unconsumed like an open key.
+utf8_result transliterate_checked(std::string_view input, std::string &output, bool &previous_was_consonant,
+                                  bool final, utf8_policy policy, const keymap &keys = keymap::builtin());
+
+// Engine counters, summed over all threads. Collected only when the library
+// is built with KHIPRO_STATS defined (make STATS=1); otherwise the counting
+// code is compiled out and snapshots are all zero.
+struct engine_stats
+{
+  static constexpr size_t scan_buckets = 16;
+  static constexpr size_t latency_buckets = 32;
+
+  // Calls that transliterate text (each batch item and pool piece counts),
+  // and their input and output bytes.
+  uint64_t calls;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  // Keys matched, by token_category.
+  uint64_t tokens[key_map_count];
+  // Bytes that start a key but begin none, and bytes that start no key;
+  // both are copied through.
+  uint64_t unmatched_bytes;
+  uint64_t pass_through_bytes;
+  // Automaton walks by the bytes they read, including the one that ended
+  // them; the last bucket holds every longer walk.
+  uint64_t scan_lengths[scan_buckets];
+  // Calls, and session keystrokes, by bit width of their duration in
+  // nanoseconds: bucket b holds durations in [2^(b-1), 2^b).
+  uint64_t call_latency[latency_buckets];
+  uint64_t keystroke_latency[latency_buckets];
+};
+
+bool stats_enabled();
+engine_stats stats_snapshot();
+
+// Zeroes the counters. Counts made concurrently by other threads may
+// survive.
+void reset_stats();
+
+// Change to apply to the output last reported by a session: drop erase bytes
+// from its end, then append insert. insert points into the session and stays
+// valid until its next call.
+struct preedit_edit
+{
+  size_t erase;
+  std::string_view insert;
+};
+
+// Incremental transliteration for IME preedit. Keys whose longest match can
+// no longer change are settled and never revisited; only the trailing
+// window that a longer key could still extend (under max_key_length bytes)
+// is re-resolved per keystroke.
+class transliteration_session
+{
+public:
+  explicit transliteration_session(const keymap &keys = keymap::builtin()) : keys_(keys) {}
+
+  preedit_edit feed(char key);
+  preedit_edit backspace();
+
+  // Returns the finished output and starts a new, empty preedit.
+  std::string commit();
+
+  void reset();
+
+  const std::string &input() const { return input_; }
+  const std::string &output() const { return output_; }
+
+private:
+  // State after a settled key; lookahead_end is one past the last input
+  // byte its match depended on.
+  struct checkpoint
+  {
+    size_t input_end;
+    size_t output_end;
+    size_t lookahead_end;
+    bool previous_was_consonant;
+  };
+
+  preedit_edit resolve_tail();
+
+  keymap keys_;
+  std::string input_;
+  std::string output_;
+  std::string tail_;
+  std::vector<checkpoint> settled_;
+};
+
+// Map from words to their outputs behind the word caches, in two
+// generations of up to capacity words each. Words are added to the current
+// generation; when it is full it becomes the previous one, replacing the
+// last, and a word found in the previous generation is copied forward. So
+// memory stays bounded and words in steady use are never dropped. Entries
+// and their text share one arena per generation, of up to
+// arena_bytes_per_word bytes per word of capacity.
+class word_table
+{
+public:
+  static constexpr size_t arena_bytes_per_word = 48;
+  // Capacity is clamped to this, so arena offsets fit in 32 bits.
+  static constexpr size_t max_capacity = UINT32_MAX / arena_bytes_per_word;
+
+  explicit word_table(size_t capacity);
+
+  // Appends the output of word to output if present.
+  bool lookup(std::string_view word, uint64_t hash, std::string &output, bool &ends_consonant);
+
+  // Returns true if it started a new generation.
+  bool insert(std::string_view word, uint64_t hash, std::string_view output, bool ends_consonant);
+
+  void clear();
+
+private:
+  struct entry
+  {
+    uint64_t hash;
+    uint32_t offset;
+    uint16_t output_length;
+    uint8_t word_length;
+    bool ends_consonant;
+  };
+
+  struct generation
+  {
+    std::vector<uint32_t> slots;
+    std::vector<entry> entries;
+    std::string arena;
+
+    const entry *find(std::string_view word, uint64_t hash) const;
+    void clear();
+  };
+
+  size_t capacity_;
+  size_t arena_limit_;
+  generation current_;
+  generation previous_;
+};
+
+struct word_cache_stats
+{
+  uint64_t hits;
+  uint64_t misses;
+  // Words transliterated without the cache: longer than
+  // max_cached_word_length, or not starting in the plain state.
+  uint64_t uncached;
+  uint64_t generations;
+};
+
+// Longest word either cache stores.
+constexpr size_t max_cached_word_length = 32;
+
+// transliterate_chunk() with memoized words. A word is a run of bytes
+// between key breaks; the consonant state is clear at its start, so its
+// output never depends on context. capacity is clamped to
+// word_table::max_capacity. Not thread-safe; see concurrent_word_cache.
+class word_cache
+{
+public:
+  explicit word_cache(size_t capacity = 1 << 16, const keymap &keys = keymap::builtin());
+
+  size_t transliterate_chunk(std::string_view input, std::string &output, bool &previous_was_consonant, bool final);
+  void transliterate(std::string_view input, std::string &output);
+
+  word_cache_stats stats() const { return stats_; }
+  void clear();
+
+private:
+  keymap keys_;
+  word_table table_;
+  word_cache_stats stats_ = {};
+};
+
+// word_cache for concurrent use. Each thread gets a table of its own, found
+// once per call without locking, so threads never contend; counts are added
+// once per call. A thread's table is freed when the thread exits, or with
+// the cache, so worker churn does not make the cache grow.
+class concurrent_word_cache
+{
+public:
+  explicit concurrent_word_cache(size_t capacity = 1 << 16, const keymap &keys = keymap::builtin());
+
+  size_t transliterate_chunk(std::string_view input, std::string &output, bool &previous_was_consonant, bool final);
+  void transliterate(std::string_view input, std::string &output);
+
+  word_cache_stats stats() const;
+
+  // Empties every thread's table. Must not run concurrently with
+  // transliterate calls.
+  void clear();
+
+private:
+  struct tables;
+  struct thread_tables;
+
+  word_table &thread_table();
+
+  keymap keys_;
+  std::shared_ptr<tables> tables_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> uncached_{0};
+  std::atomic<uint64_t> generations_{0};
+};
+
+// Runs transliterate_chunk() over independent pieces of a block on a fixed
+// set of threads. Pieces end just after key breaks, so their outputs,
+// concatenated in order, are exactly the serial output.
+class transliteration_pool
+{
+public:
+  explicit transliteration_pool(unsigned threads, const keymap &keys = keymap::builtin());
+  ~transliteration_pool();
+
+  unsigned thread_count() const { return workers_.size() + 1; }
+
+  // Transliterates block like transliterate_chunk(), leaving the output in
+  // pieces 0..piece_count() - 1. Unless final, everything after the last key
+  // break is left unconsumed.
+  size_t transliterate_block(std::string_view block, bool &previous_was_consonant, bool final);
+
+  size_t piece_count() const { return piece_count_; }
+  const std::string &piece_output(size_t index) const { return pieces_[index].output; }
+
+  // Appends the transliteration of input to output; same result as
+  // transliterate().
+  void transliterate(std::string_view input, std::string &output);
+
+  // Makes the workers go through cache, which must outlive the pool and
+  // use the same keymap; null turns it off.
+  void set_word_cache(concurrent_word_cache *cache) { cache_ = cache; }
+
+private:
+  static constexpr size_t min_piece_size = 64 << 10;
+  static constexpr size_t pieces_per_thread = 4;
+
+  struct piece
+  {
+    std::string_view input;
+    bool previous_was_consonant;
+    std::string output;
+  };
+
+  void add_piece(std::string_view input, bool previous_was_consonant);
+  void run_pieces();
+  void work_on_pieces();
+  void work();
+
+  keymap keys_;
+  concurrent_word_cache *cache_ = nullptr;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  size_t generation_ = 0;
+  // Set while run_pieces() hands out the pieces of the current generation.
+  bool running_ = false;
+  size_t busy_ = 0;
+  bool stopping_ = false;
+  std::atomic<size_t> next_piece_{0};
+  std::vector<piece> pieces_;
+  size_t piece_count_ = 0;
+};
+
+// The inverse of transliterate(): finds the shortest key sequence (in
+// bytes) that transliterates to a given text. Candidate keys at each
+// position come from a trie over the keys' outputs, and a shortest-path
+// search over (position, consonant state, live walks) keeps only sequences
+// that the longest match splits back into the same keys. A live walk is the
+// automaton walk from an earlier key start that the following keys could
+// still extend into a longer key. Bytes no key produces are typed as
+// themselves; non-ASCII ones cost untypeable_byte_cost each, so they are a
+// last resort. Text is searched one word at a time, between bytes that
+// neither occur in a key nor in an output, and scratch space is kept
+// between calls.
+class reverse_transliterator
+{
+public:
+  static constexpr uint32_t untypeable_byte_cost = 64;
+
+  explicit reverse_transliterator(const keymap &keys = keymap::builtin());
+
+  // Appends a key sequence for text to keys. Returns false, leaving keys
+  // unchanged, if no key sequence produces text.
+  bool transliterate_back(std::string_view text, std::string &keys);
+
+private:
+  static constexpr uint32_t pass_through_token = 1 << 16;
+  static constexpr uint32_t no_state = UINT32_MAX;
+
+  struct output_terminal
+  {
+    uint16_t entry;
+    bool previous_was_consonant;
+  };
+
+  // A search state; states at the same position form a list through next.
+  struct state
+  {
+    uint32_t position;
+    uint32_t live_offset;
+    uint32_t cost;
+    uint32_t parent;
+    uint32_t token;
+    uint32_t next;
+    uint16_t live_count;
+    bool previous_was_consonant;
+    bool settled;
+  };
+
+  bool search_word(std::string_view word, std::string &keys);
+  void relax(uint32_t from, std::string_view token_bytes, uint32_t token, size_t token_node, uint32_t position,
+             bool previous_was_consonant, uint32_t cost);
+  uint32_t intern(uint32_t position, bool previous_was_consonant);
+
+  keymap keys_;
+  std::vector<std::string> entry_keys_;
+  std::vector<uint16_t> entry_nodes_;
+  std::vector<bool> has_children_;
+  bool word_break_[256];
+  unsigned char output_class_[256];
+  size_t output_class_count_;
+  std::vector<uint32_t> output_transitions_;
+  std::vector<uint32_t> terminal_begin_;
+  std::vector<output_terminal> terminals_;
+  std::vector<uint32_t> shortest_key_;
+  std::vector<uint16_t> empty_outputs_[2];
+
+  std::vector<state> states_;
+  std::vector<uint16_t> live_;
+  std::vector<uint16_t> next_live_;
+  std::vector<uint32_t> position_states_;
+  std::vector<uint32_t> remaining_cost_;
+  std::vector<std::pair<uint32_t, uint32_t>> queue_;
+  std::vector<uint32_t> path_;
+};
+
+// Unigram/bigram model over tokens, the text that one key emits or one
+// copied byte, for ranking suggestions. The model file has one count per
+// line: "count<TAB>token" for a unigram, "count<TAB>previous<TAB>token" for
+// a bigram, where an empty previous stands for the start of a word.
+// khipro --train-model writes one from Bengali text. Copies share the
+// tables; a default-constructed model is empty.
+class language_model
+{
+public:
+  static constexpr uint32_t word_start = 0;
+  static constexpr uint32_t unknown = UINT32_MAX;
+
+  language_model() = default;
+
+  // Both throw std::runtime_error on malformed input.
+  static language_model parse(std::string_view text);
+  static language_model load(const std::string &path);
+
+  bool empty() const { return !tables_; }
+
+  // Id of token for cost(), or unknown.
+  uint32_t token_id(std::string_view token) const;
+
+  // -log P(token | previous): the bigram estimate interpolated with an
+  // add-one unigram estimate.
+  float cost(uint32_t previous, uint32_t token) const;
+
+private:
+  struct tables;
+
+  std::shared_ptr<const tables> tables_;
+};
+
+struct suggestion
+{
+  std::string text;
+  float cost;
+};
+
+// Ranked alternatives for an ambiguous input (kkh as ক্ষ or কখ), for
+// per-keystroke suggestions. Every split of the input into keys and copied
+// bytes is a path through a lattice over input positions. A beam of the
+// cheapest partial paths is kept per position, so appending a key only
+// builds the beam at the new end, from the beams up to max_key_length
+// positions back. Paths cost the language model's cost per token or,
+// without a model, 1 per token. The first suggestion is always the output
+// of transliterate().
+class suggestion_engine
+{
+public:
+  explicit suggestion_engine(const keymap &keys = keymap::builtin(), language_model model = language_model(),
+                             size_t beam_width = 32);
+
+  void feed(char key);
+  void backspace();
+  void reset();
+
+  // Replaces the input, keeping the beams of the prefix it shares with the
+  // current one.
+  void set_input(std::string_view input);
+
+  const std::string &input() const { return input_; }
+
+  // Up to count distinct outputs for the input, cheapest first after the
+  // transliterate() output. The result stays valid until the next call.
+  const std::vector<suggestion> &suggest(size_t count);
+
+private:
+  static constexpr uint32_t pass_through_token = 1 << 16;
+  static constexpr uint32_t no_parent = UINT32_MAX;
+
+  // A partial path ending at some position; its last token starts at start.
+  struct hypothesis
+  {
+    uint32_t parent;
+    uint32_t start;
+    uint32_t token;
+    uint32_t context;
+    uint64_t output_hash;
+    float cost;
+    bool previous_was_consonant;
+  };
+
+  void extend();
+  float token_cost(uint32_t context, uint32_t token_id) const;
+  std::string_view token_output(uint32_t token, uint32_t start, bool previous_was_consonant) const;
+  void path_output(uint32_t index, std::string &output);
+
+  keymap keys_;
+  language_model model_;
+  size_t beam_width_;
+  std::vector<uint32_t> entry_token_ids_;
+  uint32_t byte_token_ids_[256];
+
+  std::string input_;
+  std::vector<hypothesis> hypotheses_;
+  std::vector<uint32_t> beam_begin_;
+  std::vector<hypothesis> candidates_;
+  std::vector<uint32_t> path_;
+  std::vector<suggestion> suggestions_;
+};
+
+} // namespace khipro
+
+#endif
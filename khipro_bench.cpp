@@ -0,0 +1,460 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "khipro.h"
+#include "khipro_server.h"
+
+using namespace std;
+using namespace khipro;
+
+// Counts every heap allocation in the process so benchmarks can report
+// allocations per input byte.
+atomic<size_t> allocation_count{0};
+
+void *operator new(size_t size)
+{
+  allocation_count.fetch_add(1, memory_order_relaxed);
+  if (void *memory = malloc(size ? size : 1))
+  {
+    return memory;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+  free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+  free(memory);
+}
+
+// Space-separated words of 1-3 random keys from the given maps.
+string bench_words(initializer_list<token_category> categories, size_t target_bytes, mt19937 &rng)
+{
+  string text;
+  while (text.length() < target_bytes)
+  {
+    size_t keys = 1 + rng() % 3;
+    for (size_t i = 0; i < keys; ++i)
+    {
+      const key_map_ref &map = key_maps[categories.begin()[rng() % categories.size()]];
+      text += map.mappings[rng() % map.size].key;
+    }
+    text += ' ';
+  }
+  return text;
+}
+
+// Inputs named after what they stress.
+vector<pair<string, string>> bench_inputs(size_t target_bytes)
+{
+  mt19937 rng(2025);
+  vector<pair<string, string>> inputs;
+
+  inputs.emplace_back("conjunct", bench_words({TOKEN_CONJUNCT, TOKEN_VOWEL}, target_bytes, rng));
+  inputs.emplace_back("vowel", bench_words({TOKEN_VOWEL, TOKEN_VOWEL_SIGN}, target_bytes, rng));
+
+  const char *english[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "and", "of"};
+  string text;
+  while (text.length() < target_bytes)
+  {
+    text += english[rng() % size(english)];
+    text += rng() % 8 ? " " : ".\n";
+  }
+  inputs.emplace_back("english", text);
+
+  const char *pass_through[] = {"আমার", "সোনার", "বাংলা", "@", "#", "(", ")", "\"", "!", "?"};
+  text.clear();
+  while (text.length() < target_bytes)
+  {
+    text += pass_through[rng() % size(pass_through)];
+    text += ' ';
+  }
+  inputs.emplace_back("pass-through", text);
+
+  // Every proper prefix of a key that is not itself a key, followed by a
+  // byte that ends the walk: each probe fails at every length but the last.
+  vector<string_view> misses;
+  for (size_t i = 0; i < key_maps[TOKEN_CONJUNCT].size; ++i)
+  {
+    const key_mapping &mapping = key_maps[TOKEN_CONJUNCT].mappings[i];
+    for (size_t l = 2; l < mapping.key.length(); ++l)
+    {
+      string_view prefix = mapping.key.substr(0, l);
+      if (match_key(prefix, 0).length < l)
+      {
+        misses.push_back(prefix);
+      }
+    }
+  }
+  text.clear();
+  while (text.length() < target_bytes)
+  {
+    text += misses[rng() % misses.size()];
+    text += '@';
+  }
+  inputs.emplace_back("miss", text);
+  return inputs;
+}
+
+struct bench_result
+{
+  double seconds;
+  size_t iterations;
+  size_t allocations;
+};
+
+// Repeats body until at least min_seconds have passed.
+template <class F>
+bench_result run_bench(double min_seconds, F &&body)
+{
+  body();
+  bench_result result = {0, 0, 0};
+  size_t allocations = allocation_count.load(memory_order_relaxed);
+  auto start = chrono::steady_clock::now();
+  do
+  {
+    body();
+    ++result.iterations;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  } while (result.seconds < min_seconds);
+  result.allocations = allocation_count.load(memory_order_relaxed) - allocations;
+  return result;
+}
+
+void report_bench(const string &name, const bench_result &result, size_t bytes)
+{
+  double total = double(bytes) * result.iterations;
+  printf("%-28s %10.1f %10.2f %12.6f\n", name.c_str(), total / result.seconds / 1e6,
+         result.seconds * 1e9 / total, result.allocations / total);
+}
+
+struct cache_misses
+{
+  bool counted;
+  uint64_t l1d;
+  uint64_t last_level;
+};
+
+// Runs body with the calling thread's L1D and last-level cache read miss
+// counters on, where the kernel and CPU offer them (most virtual machines
+// do not).
+template <class F>
+cache_misses count_cache_misses(F &&body)
+{
+  auto open_counter = [](uint64_t cache)
+  {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  };
+  int counters[2] = {open_counter(PERF_COUNT_HW_CACHE_L1D), open_counter(PERF_COUNT_HW_CACHE_LL)};
+  uint64_t counts[2] = {0, 0};
+  bool counted = counters[0] >= 0 && counters[1] >= 0;
+  for (int fd : counters)
+  {
+    if (counted)
+    {
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  body();
+  for (int i = 0; i < 2; ++i)
+  {
+    if (counters[i] < 0)
+    {
+      continue;
+    }
+    ioctl(counters[i], PERF_EVENT_IOC_DISABLE, 0);
+    counted = read(counters[i], &counts[i], sizeof(counts[i])) == sizeof(counts[i]) && counted;
+    close(counters[i]);
+  }
+  return {counted, counts[0], counts[1]};
+}
+
+// Throughput of each entry point over synthetic inputs; keystroke numbers
+// are nanoseconds per session feed(), suggest numbers per keystroke and
+// reverse numbers per byte of Bengali.
+int run_benchmarks(double min_seconds)
+{
+  printf("%-28s %10s %10s %12s\n", "benchmark", "MB/s", "ns/byte", "allocs/byte");
+  string output_str;
+  unsigned threads = max(thread::hardware_concurrency(), 1u);
+  transliteration_pool pool(threads);
+
+  for (const auto &input : bench_inputs(4 << 20))
+  {
+    const string &text = input.second;
+    report_bench("tokenize/" + input.first, run_bench(min_seconds, [&] { tokenize(text); }), text.length());
+    report_bench("transliterate/" + input.first, run_bench(min_seconds, [&]
+                                                           {
+                                                             output_str.clear();
+                                                             transliterate(text, output_str);
+                                                           }),
+                 text.length());
+    report_bench("pool-" + to_string(threads) + "/" + input.first, run_bench(min_seconds, [&]
+                                                                          {
+                                                                            output_str.clear();
+                                                                            pool.transliterate(text, output_str);
+                                                                          }),
+                 text.length());
+
+    word_cache cache;
+    report_bench("cached/" + input.first, run_bench(min_seconds, [&]
+                                                    {
+                                                      output_str.clear();
+                                                      cache.transliterate(text, output_str);
+                                                    }),
+                 text.length());
+
+    string_view keys = string_view(text).substr(0, 64 << 10);
+    transliteration_session session;
+    report_bench("keystroke/" + input.first, run_bench(min_seconds, [&]
+                                                       {
+                                                         for (char key : keys)
+                                                         {
+                                                           if (key == ' ')
+                                                           {
+                                                             session.reset();
+                                                           }
+                                                           session.feed(key);
+                                                         }
+                                                         session.reset();
+                                                       }),
+                 keys.length());
+
+    string bengali = transliterate(text);
+    report_bench("utf8-check/" + input.first, run_bench(min_seconds, [&] { find_malformed_utf8(bengali); }),
+                 bengali.length());
+
+    string reversed;
+    reverse_transliterator reverse;
+    report_bench("reverse/" + input.first, run_bench(min_seconds, [&]
+                                                     {
+                                                       reversed.clear();
+                                                       reverse.transliterate_back(bengali, reversed);
+                                                     }),
+                 bengali.length());
+  }
+
+  // The built-in tables against the same reordered for a profile of text
+  // of the same mix, with the table lines that serve 99% of its reads and,
+  // where counters are available, cache misses per KB of input.
+  {
+    string profile_text;
+    for (const auto &input : bench_inputs(1 << 20))
+    {
+      profile_text += input.second;
+    }
+    string text;
+    for (const auto &input : bench_inputs(4 << 20))
+    {
+      text += input.second;
+    }
+    keymap reordered = keymap::builtin().reorder(profile_keys(profile_text));
+    printf("%-28s %10s %10s %12s %12s %12s\n", "layout", "MB/s", "ns/byte", "99% lines", "L1D miss/KB",
+           "LL miss/KB");
+    const keymap *layouts[] = {&keymap::builtin(), &reordered};
+    for (const keymap *keys : layouts)
+    {
+      bench_result result;
+      cache_misses misses = count_cache_misses([&]
+                                               {
+                                                 result = run_bench(min_seconds, [&]
+                                                                    {
+                                                                      output_str.clear();
+                                                                      transliterate(text, output_str, *keys);
+                                                                    });
+                                               });
+      double total = double(text.length()) * result.iterations;
+      size_t lines = profile_cache_lines(profile_keys(text, *keys), 0.99, *keys);
+      string name = keys == &reordered ? "layout/profiled" : "layout/builtin";
+      if (misses.counted)
+      {
+        printf("%-28s %10.1f %10.2f %12zu %12.2f %12.2f\n", name.c_str(), total / result.seconds / 1e6,
+               result.seconds * 1e9 / total, lines, misses.l1d * 1024 / total, misses.last_level * 1024 / total);
+      }
+      else
+      {
+        printf("%-28s %10.1f %10.2f %12zu %12s %12s\n", name.c_str(), total / result.seconds / 1e6,
+               result.seconds * 1e9 / total, lines, "n/a", "n/a");
+      }
+    }
+    printf("%-28s %10s %10s %12s\n", "benchmark", "MB/s", "ns/byte", "allocs/byte");
+  }
+
+  // One suggest() per keystroke over 20-key words.
+  {
+    const string &text = bench_inputs(64 << 10)[0].second;
+    string_view keys = text;
+    suggestion_engine suggestions;
+    report_bench("suggest/20-key words", run_bench(min_seconds, [&]
+                                                   {
+                                                     for (size_t i = 0; i < keys.length(); ++i)
+                                                     {
+                                                       if (i % 20 == 0)
+                                                       {
+                                                         suggestions.reset();
+                                                       }
+                                                       suggestions.feed(keys[i]);
+                                                       suggestions.suggest(5);
+                                                     }
+                                                   }),
+                 keys.length());
+  }
+
+  // Many short fields, one call each versus one batch.
+  vector<string_view> fields;
+  size_t field_bytes = 0;
+  vector<pair<string, string>> inputs = bench_inputs(1 << 20);
+  for (const auto &input : inputs)
+  {
+    string_view text = input.second;
+    for (size_t start = 0, end; start < text.length(); start = end + 1)
+    {
+      end = min(text.find_first_of(" \n", start), text.length());
+      fields.push_back(text.substr(start, end - start));
+      field_bytes += end - start;
+    }
+  }
+  report_bench("fields/per-call", run_bench(min_seconds, [&]
+                                            {
+                                              for (string_view field : fields)
+                                              {
+                                                transliterate(field);
+                                              }
+                                            }),
+               field_bytes);
+  transliteration_batch batch;
+  report_bench("fields/batch", run_bench(min_seconds, [&]
+                                         {
+                                           batch.clear();
+                                           transliterate_batch(fields.data(), fields.size(), batch);
+                                         }),
+               field_bytes);
+
+  // Some of the fields through a server on a local socket: one request at
+  // a time, pipelined, and in batches of 1000. The server buffers its
+  // responses, so pipelined requests can all be sent before reading.
+  try
+  {
+    string socket_path = "/tmp/khipro-bench-" + to_string(getpid()) + ".sock";
+    transliteration_server server(socket_path, threads);
+    thread loop([&] { server.run(); });
+    {
+      server_connection client(socket_path);
+      fields.resize(min<size_t>(fields.size(), 20000));
+      field_bytes = 0;
+      string frames;
+      string batch_frames;
+      string payload;
+      size_t batch_count = 0;
+      for (size_t i = 0; i < fields.size(); ++i)
+      {
+        field_bytes += fields[i].length();
+        append_frame(frames, SERVER_TRANSLITERATE, fields[i]);
+        if (i % 1000 == 0)
+        {
+          size_t count = min<size_t>(fields.size() - i, 1000);
+          payload.clear();
+          append_batch(payload, &fields[i], count);
+          append_frame(batch_frames, SERVER_BATCH, payload);
+          ++batch_count;
+        }
+      }
+      uint8_t status;
+      report_bench("server/round-trip", run_bench(min_seconds, [&]
+                                                  {
+                                                    for (string_view field : fields)
+                                                    {
+                                                      client.send(SERVER_TRANSLITERATE, field);
+                                                      client.receive(status, payload);
+                                                    }
+                                                  }),
+                   field_bytes);
+      report_bench("server/pipelined", run_bench(min_seconds, [&]
+                                                 {
+                                                   client.send_frames(frames);
+                                                   for (size_t i = 0; i < fields.size(); ++i)
+                                                   {
+                                                     client.receive(status, payload);
+                                                   }
+                                                 }),
+                   field_bytes);
+      report_bench("server/batch", run_bench(min_seconds, [&]
+                                             {
+                                               client.send_frames(batch_frames);
+                                               for (size_t i = 0; i < batch_count; ++i)
+                                               {
+                                                 client.receive(status, payload);
+                                               }
+                                             }),
+                   field_bytes);
+    }
+    server.stop();
+    loop.join();
+  }
+  catch (const runtime_error &error)
+  {
+    cerr << "khipro: " << error.what() << endl;
+  }
+  return 0;
+}
+
+// khipro_bench [seconds]: runs each benchmark for at least that long (half a
+// second by default).
+int main(int argc, char **argv)
+{
+  return run_benchmarks(argc > 1 ? atof(argv[1]) : 0.5);
+}
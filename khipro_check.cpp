@@ -0,0 +1,367 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "khipro.h"
+#include "khipro_check.h"
+
+using namespace std;
+using namespace khipro;
+
+// The original probing tokenizer and if/else map chain, kept as the oracle
+// the compiled engine is verified against.
+string reference_transliterate(const string &input)
+{
+  static const auto maps = []
+  {
+    vector<unordered_map<string, string>> maps(size(key_maps));
+    for (const key_map_ref &map : key_maps)
+    {
+      for (size_t i = 0; i < map.size; ++i)
+      {
+        maps[map.category].emplace(map.mappings[i].key, map.mappings[i].value);
+      }
+    }
+    return maps;
+  }();
+  const auto &vowel_signs = maps[TOKEN_VOWEL_SIGN];
+
+  vector<string> tokens;
+  size_t i = 0;
+  while (i < input.length())
+  {
+    size_t l = min<size_t>(max_token_length, input.length() - i);
+    for (; l > 0; --l)
+    {
+      string segment = input.substr(i, l);
+      if (any_of(maps.begin(), maps.end(), [&](const auto &map) { return map.count(segment) != 0; }))
+      {
+        break;
+      }
+    }
+    l = max<size_t>(l, 1);
+    tokens.push_back(input.substr(i, l));
+    i += l;
+  }
+
+  string output_str;
+  bool previous_was_consonant = false;
+  for (const string &token : tokens)
+  {
+    if (maps[TOKEN_CONJUNCT].count(token) || maps[TOKEN_CONSONANT].count(token))
+    {
+      output_str += maps[maps[TOKEN_CONJUNCT].count(token) ? TOKEN_CONJUNCT : TOKEN_CONSONANT].at(token);
+      previous_was_consonant = true;
+    }
+    else if (maps[TOKEN_DIACRITIC].count(token) || maps[TOKEN_REPH].count(token) ||
+             maps[TOKEN_PUNCTUATION].count(token))
+    {
+      token_category category = maps[TOKEN_DIACRITIC].count(token) ? TOKEN_DIACRITIC
+                                : maps[TOKEN_REPH].count(token)    ? TOKEN_REPH
+                                                                   : TOKEN_PUNCTUATION;
+      output_str += maps[category].at(token);
+      previous_was_consonant = false;
+    }
+    else if (maps[TOKEN_PHOLA].count(token))
+    {
+      if (previous_was_consonant)
+      {
+        output_str += "্";
+      }
+      output_str += maps[TOKEN_PHOLA].at(token);
+      previous_was_consonant = true;
+    }
+    else if (maps[TOKEN_VOWEL].count(token))
+    {
+      if (previous_was_consonant && vowel_signs.count(token))
+      {
+        output_str += vowel_signs.at(token);
+      }
+      else
+      {
+        output_str += maps[TOKEN_VOWEL].at(token);
+      }
+      previous_was_consonant = false;
+    }
+    else if (vowel_signs.count(token))
+    {
+      output_str += vowel_signs.at(token);
+      previous_was_consonant = false;
+    }
+    else if (maps[TOKEN_DIGIT].count(token))
+    {
+      output_str += maps[TOKEN_DIGIT].at(token);
+      previous_was_consonant = false;
+    }
+    else
+    {
+      output_str += token;
+      previous_was_consonant = false;
+    }
+  }
+  return output_str;
+}
+
+// Every key of every map, plus the combinations whose output depends on
+// context: consonant + vowel, conjunct + phola, reph + conjunct, and digit
+// and punctuation runs.
+vector<string> golden_cases()
+{
+  vector<string> cases;
+  for (const key_map_ref &map : key_maps)
+  {
+    for (size_t i = 0; i < map.size; ++i)
+    {
+      cases.emplace_back(map.mappings[i].key);
+    }
+  }
+
+  auto combine = [&](token_category first, token_category second)
+  {
+    for (size_t i = 0; i < key_maps[first].size; ++i)
+    {
+      for (size_t j = 0; j < key_maps[second].size; ++j)
+      {
+        cases.push_back(string(key_maps[first].mappings[i].key) + string(key_maps[second].mappings[j].key));
+      }
+    }
+  };
+  combine(TOKEN_CONSONANT, TOKEN_VOWEL);
+  combine(TOKEN_CONSONANT, TOKEN_VOWEL_SIGN);
+  combine(TOKEN_CONJUNCT, TOKEN_PHOLA);
+  combine(TOKEN_CONJUNCT, TOKEN_VOWEL);
+  combine(TOKEN_CONSONANT, TOKEN_PHOLA);
+  combine(TOKEN_PHOLA, TOKEN_VOWEL);
+  combine(TOKEN_REPH, TOKEN_CONJUNCT);
+  combine(TOKEN_REPH, TOKEN_CONSONANT);
+  combine(TOKEN_DIGIT, TOKEN_DIGIT);
+  combine(TOKEN_PUNCTUATION, TOKEN_PUNCTUATION);
+  combine(TOKEN_PUNCTUATION, TOKEN_DIGIT);
+  combine(TOKEN_DIACRITIC, TOKEN_DIACRITIC);
+  return cases;
+}
+
+// Offset of the first malformed UTF-8 byte, found by decoding code points
+// and range checking them; the oracle for find_malformed_utf8().
+size_t reference_malformed_utf8(string_view text)
+{
+  static const uint32_t smallest[5] = {0, 0, 0x80, 0x800, 0x10000};
+  for (size_t i = 0; i < text.length();)
+  {
+    unsigned char lead = text[i];
+    size_t length = lead < 0x80 ? 1 : lead < 0xc0 ? 0 : lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : lead < 0xf8 ? 4 : 0;
+    if (length == 0 || i + length > text.length())
+    {
+      return i;
+    }
+    uint32_t code_point = length == 1 ? lead : lead & (0x7f >> length);
+    for (size_t k = 1; k < length; ++k)
+    {
+      unsigned char c = text[i + k];
+      if ((c & 0xc0) != 0x80)
+      {
+        return i;
+      }
+      code_point = code_point << 6 | (c & 0x3f);
+    }
+    if (code_point < smallest[length] || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+    {
+      return i;
+    }
+    i += length;
+  }
+  return text.length();
+}
+
+// Checks every engine against expected for input, returning the first that
+// disagrees, or an empty string.
+string check_engines(const string &input, const string &expected)
+{
+  if (transliterate(input) != expected)
+  {
+    return "transliterate";
+  }
+  if (expected.length() > transliterated_size_bound(input))
+  {
+    return "transliterated_size_bound";
+  }
+  string buffer(expected.length(), '\0');
+  if (transliterate(input, buffer.data(), buffer.length()) != expected.length() || buffer != expected)
+  {
+    return "transliterate into buffer";
+  }
+
+  transliteration_session session;
+  for (char key : input)
+  {
+    session.feed(key);
+  }
+  if (session.output() != expected)
+  {
+    return "session";
+  }
+  for (size_t erased = 0; erased < input.length(); ++erased)
+  {
+    session.backspace();
+  }
+  for (char key : input)
+  {
+    session.feed(key);
+  }
+  if (session.commit() != expected)
+  {
+    return "session after backspace";
+  }
+
+  for (size_t split = 0; split <= input.length(); ++split)
+  {
+    string output_str;
+    bool previous_was_consonant = false;
+    size_t consumed = transliterate_chunk(string_view(input).substr(0, split), output_str,
+                                          previous_was_consonant, false);
+    transliterate_chunk(string_view(input).substr(consumed), output_str, previous_was_consonant, true);
+    if (output_str != expected)
+    {
+      return "transliterate_chunk split at " + to_string(split);
+    }
+  }
+
+  string joined;
+  for (const string &token : tokenize(input))
+  {
+    joined += token;
+  }
+  if (joined != input)
+  {
+    return "tokenize";
+  }
+
+  // Reporting transliterates up to the first malformed byte; replacing
+  // always writes valid UTF-8, and the same as transliterate() when there
+  // was nothing to replace.
+  size_t malformed = reference_malformed_utf8(input);
+  if (find_malformed_utf8(input) != malformed)
+  {
+    return "find_malformed_utf8";
+  }
+  string checked;
+  bool previous_was_consonant = false;
+  utf8_result reported = transliterate_checked(input, checked, previous_was_consonant, true, UTF8_REPORT);
+  if (reported.consumed != malformed || checked != transliterate(input.substr(0, malformed)))
+  {
+    return "transliterate_checked report";
+  }
+  string replaced;
+  previous_was_consonant = false;
+  transliterate_checked(input, replaced, previous_was_consonant, true, UTF8_REPLACE);
+  if (find_malformed_utf8(replaced) != replaced.length() || (malformed == input.length() && replaced != expected))
+  {
+    return "transliterate_checked replace";
+  }
+  for (size_t split = 0; split <= input.length(); ++split)
+  {
+    string output_str;
+    previous_was_consonant = false;
+    size_t consumed = transliterate_checked(string_view(input).substr(0, split), output_str, previous_was_consonant,
+                                            false, UTF8_REPLACE)
+                          .consumed;
+    transliterate_checked(string_view(input).substr(consumed), output_str, previous_was_consonant, true,
+                          UTF8_REPLACE);
+    if (output_str != replaced)
+    {
+      return "transliterate_checked split at " + to_string(split);
+    }
+  }
+
+  // A tiny cache, so that words also come from the previous generation and
+  // generations turn over often.
+  static word_cache cache(4);
+  for (size_t split = 0; split <= input.length(); ++split)
+  {
+    string output_str;
+    bool previous_was_consonant = false;
+    size_t consumed = cache.transliterate_chunk(string_view(input).substr(0, split), output_str,
+                                                previous_was_consonant, false);
+    cache.transliterate_chunk(string_view(input).substr(consumed), output_str, previous_was_consonant, true);
+    if (output_str != expected)
+    {
+      return "word_cache split at " + to_string(split);
+    }
+  }
+
+  // The first suggestion is the plain output, whether the lattice was
+  // built from scratch or from the previous case's beams.
+  static suggestion_engine shared_suggestions;
+  suggestion_engine suggestions;
+  for (char key : input)
+  {
+    suggestions.feed(key);
+  }
+  shared_suggestions.set_input(input);
+  const vector<suggestion> &fresh = suggestions.suggest(8);
+  const vector<suggestion> &shared = shared_suggestions.suggest(8);
+  if (!input.empty() && (fresh.empty() || fresh[0].text != expected))
+  {
+    return "suggestion_engine";
+  }
+  for (size_t i = 0; i < fresh.size(); ++i)
+  {
+    if (i >= shared.size() || shared[i].text != fresh[i].text)
+    {
+      return "suggestion_engine after set_input";
+    }
+  }
+
+  // input is one key sequence for expected, so the shortest one costs no
+  // more.
+  static reverse_transliterator reverse;
+  auto typing_cost = [](const string &keys)
+  {
+    size_t cost = 0;
+    for (char c : keys)
+    {
+      cost += (unsigned char)c < 0x80 ? 1 : reverse_transliterator::untypeable_byte_cost;
+    }
+    return cost;
+  };
+  string keys;
+  if (!reverse.transliterate_back(expected, keys) || transliterate(keys) != expected)
+  {
+    return "reverse_transliterator";
+  }
+  if (typing_cost(keys) > typing_cost(input))
+  {
+    return "reverse_transliterator cost";
+  }
+  return "";
+}
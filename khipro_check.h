@@ -0,0 +1,52 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef KHIPRO_CHECK_H
+#define KHIPRO_CHECK_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Oracles and differential checks shared by khipro_verify and khipro_fuzz.
+
+// The original probing tokenizer and if/else map chain, built from the
+// same tables as the engine.
+std::string reference_transliterate(const std::string &input);
+
+// Every key of every map, plus the combinations whose output depends on
+// context.
+std::vector<std::string> golden_cases();
+
+// Offset of the first malformed UTF-8 byte in text.
+size_t reference_malformed_utf8(std::string_view text);
+
+// Checks every engine against expected for input, returning the first that
+// disagrees, or an empty string.
+std::string check_engines(const std::string &input, const std::string &expected);
+
+#endif
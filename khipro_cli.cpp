@@ -0,0 +1,767 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "khipro.h"
+#include "khipro_server.h"
+
+using namespace std;
+using namespace khipro;
+
+constexpr size_t stream_block_size = 1 << 20;
+
+// Target size of each request --connect sends.
+constexpr size_t server_request_size = 256 << 10;
+
+bool write_all(int fd, string_view data)
+{
+  while (!data.empty())
+  {
+    ssize_t written = write(fd, data.data(), data.size());
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(written);
+  }
+  return true;
+}
+
+// --utf8 checking for transliterate_fd(): the policy, what was found and
+// where it was first found in the current file.
+struct utf8_check
+{
+  utf8_policy policy;
+  size_t malformed = 0;
+  size_t first_malformed = string_view::npos;
+};
+
+// Transliterates everything readable from in_fd to out_fd, on pool's threads
+// when one is given. Regular files are mapped and walked in place; pipes and
+// terminals are read in large blocks, carrying unsettled trailing input over
+// into the next block. Output is written once per block, never per line.
+// With utf8, blocks are cut on code point boundaries and checked first; the
+// rare block with malformed input goes through transliterate_checked().
+bool transliterate_fd(int in_fd, int out_fd, const keymap &keys, transliteration_pool *pool, word_cache *cache,
+                      utf8_check *utf8)
+{
+  size_t block_size = pool ? stream_block_size * pool->thread_count() * 4 : stream_block_size;
+  string output_str;
+  bool previous_was_consonant = false;
+  bool ok = true;
+  size_t offset = 0;
+
+  // Settles and writes as much of block as possible, returning the bytes
+  // consumed.
+  auto settle = [&](string_view block, bool final) -> size_t
+  {
+    if (utf8)
+    {
+      if (!final)
+      {
+        block = block.substr(0, complete_utf8_length(block));
+      }
+      if (find_malformed_utf8(block) != block.length())
+      {
+        output_str.clear();
+        utf8_result result = transliterate_checked(block, output_str, previous_was_consonant, final, utf8->policy,
+                                                   keys);
+        ok = write_all(out_fd, output_str);
+        if (utf8->first_malformed == string_view::npos)
+        {
+          utf8->first_malformed = offset + result.first_malformed;
+        }
+        utf8->malformed += result.malformed;
+        if (utf8->policy == UTF8_REPORT)
+        {
+          errno = EILSEQ;
+          ok = false;
+        }
+        return result.consumed;
+      }
+    }
+    if (!pool)
+    {
+      output_str.clear();
+      size_t consumed = cache ? cache->transliterate_chunk(block, output_str, previous_was_consonant, final)
+                              : transliterate_chunk(block, output_str, previous_was_consonant, final, keys);
+      ok = write_all(out_fd, output_str);
+      return consumed;
+    }
+    size_t consumed = pool->transliterate_block(block, previous_was_consonant, final);
+    for (size_t i = 0; ok && i < pool->piece_count(); ++i)
+    {
+      ok = write_all(out_fd, pool->piece_output(i));
+    }
+    return consumed;
+  };
+  auto process = [&](string_view block, bool final)
+  {
+    size_t consumed = settle(block, final);
+    offset += consumed;
+    return consumed;
+  };
+
+  struct stat info;
+  if (fstat(in_fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+  {
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (mapped != MAP_FAILED)
+    {
+      madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+      string_view data(static_cast<const char *>(mapped), info.st_size);
+      size_t pos = 0;
+      while (ok && pos < data.length())
+      {
+        size_t end = min(data.length(), pos + block_size);
+        pos += process(data.substr(pos, end - pos), end == data.length());
+      }
+      munmap(mapped, info.st_size);
+      return ok;
+    }
+  }
+
+  string buffer(block_size, '\0');
+  size_t pending = 0;
+  while (ok)
+  {
+    ssize_t count = read(in_fd, &buffer[pending], buffer.length() - pending);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    bool final = count == 0;
+    size_t available = pending + count;
+    size_t consumed = process(string_view(buffer.data(), available), final);
+    pending = available - consumed;
+    buffer.replace(0, pending, buffer, consumed, pending);
+    if (final)
+    {
+      break;
+    }
+  }
+  return ok;
+}
+
+// Writes a key sequence for every line of in_fd to out_fd. Lines no key
+// sequence produces are reported and copied unchanged.
+bool reverse_fd(int in_fd, int out_fd, const string &path, reverse_transliterator &reverse)
+{
+  string input_str;
+  string buffer(stream_block_size, '\0');
+  ssize_t count;
+  while ((count = read(in_fd, &buffer[0], buffer.length())) != 0)
+  {
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    input_str.append(buffer, 0, count);
+  }
+
+  string output_str;
+  bool ok = true;
+  size_t line_number = 0;
+  for (size_t start = 0; start < input_str.length();)
+  {
+    size_t end = min(input_str.find('\n', start), input_str.length());
+    string_view line = string_view(input_str).substr(start, end - start);
+    ++line_number;
+    if (!reverse.transliterate_back(line, output_str))
+    {
+      cerr << "khipro: " << path << ":" << line_number << ": no key sequence produces this line" << endl;
+      output_str += line;
+    }
+    if (end < input_str.length())
+    {
+      output_str += '\n';
+    }
+    start = end + 1;
+    if (output_str.length() >= stream_block_size)
+    {
+      ok = ok && write_all(out_fd, output_str);
+      output_str.clear();
+    }
+  }
+  return write_all(out_fd, output_str) && ok;
+}
+
+// Reorders keys hot-first for the text of corpus_path, which is typed keys
+// rather than Bengali (--reverse turns one into the other), and reports the
+// table lines that serve 99% of its reads before and after.
+keymap profile_layout(const keymap &keys, const char *corpus_path)
+{
+  ifstream corpus(corpus_path, ios::binary);
+  if (!corpus)
+  {
+    throw runtime_error(string(corpus_path) + ": " + strerror(errno));
+  }
+  string text((istreambuf_iterator<char>(corpus)), istreambuf_iterator<char>());
+  key_profile profile = profile_keys(text, keys);
+  keymap reordered = keys.reorder(profile);
+  cerr << "khipro: 99% of table reads in " << profile_cache_lines(profile_keys(text, reordered), 0.99, reordered)
+       << " cache lines, " << profile_cache_lines(profile, 0.99, keys) << " before reordering" << endl;
+  return reordered;
+}
+
+// Writes a language_model file from the Bengali words of corpus_path,
+// split into tokens by reversing each word to keys and transliterating it
+// again key by key.
+int train_model(const char *corpus_path, const char *model_path)
+{
+  ifstream corpus(corpus_path);
+  if (!corpus)
+  {
+    cerr << "khipro: " << corpus_path << ": " << strerror(errno) << endl;
+    return 1;
+  }
+  reverse_transliterator reverse;
+  unordered_map<string, uint64_t> unigrams;
+  unordered_map<string, uint64_t> bigrams;
+  string line;
+  string keys;
+  while (getline(corpus, line))
+  {
+    for (size_t start = 0, end; start < line.length(); start = end + 1)
+    {
+      end = min(line.find_first_of(" \t\r", start), line.length());
+      keys.clear();
+      if (end == start || !reverse.transliterate_back(string_view(line).substr(start, end - start), keys))
+      {
+        continue;
+      }
+      string previous;
+      bool previous_was_consonant = false;
+      for (const string &token_keys : tokenize(keys))
+      {
+        string token;
+        transliterate_chunk(token_keys, token, previous_was_consonant, true);
+        if (token.empty())
+        {
+          continue;
+        }
+        unigrams[token]++;
+        bigrams[previous + '\t' + token]++;
+        previous = token;
+      }
+    }
+  }
+
+  ofstream model(model_path);
+  for (const auto &unigram : unigrams)
+  {
+    model << unigram.second << '\t' << unigram.first << '\n';
+  }
+  for (const auto &bigram : bigrams)
+  {
+    model << bigram.second << '\t' << bigram.first << '\n';
+  }
+  model.close();
+  if (!model)
+  {
+    cerr << "khipro: " << model_path << ": " << strerror(errno) << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Sends everything readable from in_fd to server as transliterate requests
+// cut just after key breaks, so each one transliterates on its own.
+bool send_fd(server_connection &server, int in_fd, const keymap &keys)
+{
+  string pending;
+  string block(server_request_size, '\0');
+  while (true)
+  {
+    ssize_t count = read(in_fd, &block[0], block.length());
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    pending.append(block, 0, count);
+    bool final = count == 0;
+    size_t cut = pending.length();
+    if (!final)
+    {
+      if (pending.length() < server_request_size)
+      {
+        continue;
+      }
+      while (cut > 0 && !is_key_break(pending[cut - 1], keys))
+      {
+        --cut;
+      }
+      if (cut == 0 && pending.length() < server_max_payload)
+      {
+        continue;
+      }
+      if (cut == 0)
+      {
+        errno = EMSGSIZE;
+        return false;
+      }
+    }
+    if (cut > 0 && !server.send(SERVER_TRANSLITERATE, string_view(pending).substr(0, cut)))
+    {
+      return false;
+    }
+    pending.erase(0, cut);
+    if (final)
+    {
+      return true;
+    }
+  }
+}
+
+// Transliterates the files at paths ("-" for stdin) to stdout through the
+// server at socket_path, pipelining the requests over one connection; with
+// show_stats, then prints the server's counters.
+int run_client(const string &socket_path, char **paths, int path_count, const keymap &keys, bool show_stats)
+{
+  atomic<int> status{0};
+  try
+  {
+    server_connection server(socket_path);
+    thread reader([&]
+                  {
+                    uint8_t response_status;
+                    string payload;
+                    bool written = true;
+                    while (server.receive(response_status, payload))
+                    {
+                      if (response_status != SERVER_OK)
+                      {
+                        cerr << "khipro: " << socket_path << ": " << payload << endl;
+                        status = 1;
+                      }
+                      else if (written && !(written = write_all(STDOUT_FILENO, payload)))
+                      {
+                        cerr << "khipro: stdout: " << strerror(errno) << endl;
+                        status = 1;
+                      }
+                    }
+                  });
+    for (int i = 0; i < path_count; ++i)
+    {
+      string path = paths[i];
+      int fd = path == "-" ? STDIN_FILENO : open(paths[i], O_RDONLY);
+      if (fd < 0 || !send_fd(server, fd, keys))
+      {
+        cerr << "khipro: " << path << ": " << strerror(errno) << endl;
+        status = 1;
+      }
+      if (fd > STDIN_FILENO)
+      {
+        close(fd);
+      }
+    }
+    server.finish_sending();
+    reader.join();
+
+    if (show_stats)
+    {
+      server_connection stats_connection(socket_path);
+      uint8_t response_status;
+      string payload;
+      if (stats_connection.send(SERVER_STATS, "") && stats_connection.receive(response_status, payload))
+      {
+        fputs(payload.c_str(), stderr);
+      }
+    }
+  }
+  catch (const runtime_error &error)
+  {
+    cerr << "khipro: " << error.what() << endl;
+    return 1;
+  }
+  return status.load();
+}
+
+transliteration_server *running_server = nullptr;
+
+void stop_server(int)
+{
+  if (running_server)
+  {
+    running_server->stop();
+  }
+}
+
+// Serves on socket_path until SIGINT or SIGTERM; with show_stats, then
+// prints the server's counters.
+int serve(const string &socket_path, unsigned threads, const keymap &keys, bool use_cache, bool show_stats)
+{
+  try
+  {
+    unique_ptr<concurrent_word_cache> cache;
+    if (use_cache)
+    {
+      cache = make_unique<concurrent_word_cache>(1 << 16, keys);
+    }
+    transliteration_server server(socket_path, threads, keys, cache.get());
+    running_server = &server;
+    struct sigaction action = {};
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    server.run();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    running_server = nullptr;
+    if (show_stats)
+    {
+      fputs(format_server_stats(server.stats()).c_str(), stderr);
+    }
+  }
+  catch (const runtime_error &error)
+  {
+    cerr << "khipro: " << error.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Prints an engine_stats snapshot. Histograms list only non-empty buckets,
+// as "bucket:count".
+void print_stats(FILE *out)
+{
+  if (!stats_enabled())
+  {
+    fprintf(out, "stats: not built in (make STATS=1)\n");
+    return;
+  }
+  engine_stats stats = stats_snapshot();
+  auto histogram = [&](const char *name, const uint64_t *buckets, size_t count)
+  {
+    fprintf(out, "%-20s", name);
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (buckets[i] != 0)
+      {
+        fprintf(out, " %zu:%llu", i, (unsigned long long)buckets[i]);
+      }
+    }
+    fprintf(out, "\n");
+  };
+
+  fprintf(out, "%-20s %llu\n", "calls", (unsigned long long)stats.calls);
+  fprintf(out, "%-20s %llu\n", "bytes in", (unsigned long long)stats.bytes_in);
+  fprintf(out, "%-20s %llu\n", "bytes out", (unsigned long long)stats.bytes_out);
+  const char *categories[key_map_count] = {"conjunct", "consonant", "diacritic", "reph", "punctuation",
+                                           "phola", "vowel", "vowel sign", "digit"};
+  for (size_t i = 0; i < key_map_count; ++i)
+  {
+    fprintf(out, "%-20s %llu\n", (string("tokens/") + categories[i]).c_str(), (unsigned long long)stats.tokens[i]);
+  }
+  fprintf(out, "%-20s %llu\n", "unmatched bytes", (unsigned long long)stats.unmatched_bytes);
+  fprintf(out, "%-20s %llu\n", "pass-through bytes", (unsigned long long)stats.pass_through_bytes);
+  histogram("scan lengths", stats.scan_lengths, engine_stats::scan_buckets);
+  histogram("call latency log2ns", stats.call_latency, engine_stats::latency_buckets);
+  histogram("keystroke log2ns", stats.keystroke_latency, engine_stats::latency_buckets);
+}
+
+// With file arguments ("-" for stdin), transliterates them to stdout in
+// bulk, on N threads with -j N, or back to keys with --reverse, and with
+// --stats prints the engine counters when done; --serve SOCKET serves them
+// to other processes and --connect SOCKET sends the files to such a server;
+// --compile-layout LAYOUT OUT [--profile CORPUS] writes a compiled image;
+// otherwise runs the interactive prompt.
+int main(int argc, char **argv)
+{
+  if (argc > 3 && string(argv[1]) == "--train-model")
+  {
+    return train_model(argv[2], argv[3]);
+  }
+  if (argc > 1 && string(argv[1]) == "--dump-layout")
+  {
+    cout << format_layout();
+    return 0;
+  }
+
+  unsigned threads = 0;
+  keymap keys = keymap::builtin();
+  bool reverse = false;
+  bool show_stats = false;
+  bool use_cache = false;
+  unique_ptr<utf8_check> utf8;
+  size_t suggestion_count = 0;
+  language_model model;
+  string serve_path;
+  string connect_path;
+  int first_file = 1;
+  try
+  {
+    if (argc > 3 && string(argv[1]) == "--compile-layout")
+    {
+      keymap compiled = keymap::load(argv[2]);
+      if (argc > 5 && string(argv[4]) == "--profile")
+      {
+        compiled = profile_layout(compiled, argv[5]);
+      }
+      compiled.save_compiled(argv[3]);
+      return 0;
+    }
+    while (argc > first_file)
+    {
+      string option = argv[first_file];
+      if (option == "--reverse")
+      {
+        reverse = true;
+        first_file += 1;
+      }
+      else if (option == "--stats")
+      {
+        show_stats = true;
+        first_file += 1;
+      }
+      else if (option == "--cache")
+      {
+        use_cache = true;
+        first_file += 1;
+      }
+      else if (option == "-j" && argc > first_file + 1)
+      {
+        threads = max(atoi(argv[first_file + 1]), 1);
+        first_file += 2;
+      }
+      else if (option == "--layout" && argc > first_file + 1)
+      {
+        keys = keymap::load(argv[first_file + 1]);
+        first_file += 2;
+      }
+      else if (option == "--suggest" && argc > first_file + 1)
+      {
+        suggestion_count = max(atoi(argv[first_file + 1]), 1);
+        first_file += 2;
+      }
+      else if (option == "--model" && argc > first_file + 1)
+      {
+        model = language_model::load(argv[first_file + 1]);
+        first_file += 2;
+      }
+      else if (option == "--utf8" && argc > first_file + 1 &&
+               (string(argv[first_file + 1]) == "report" || string(argv[first_file + 1]) == "replace"))
+      {
+        utf8 = make_unique<utf8_check>();
+        utf8->policy = string(argv[first_file + 1]) == "report" ? UTF8_REPORT : UTF8_REPLACE;
+        first_file += 2;
+      }
+      else if (option == "--serve" && argc > first_file + 1)
+      {
+        serve_path = argv[first_file + 1];
+        first_file += 2;
+      }
+      else if (option == "--connect" && argc > first_file + 1)
+      {
+        connect_path = argv[first_file + 1];
+        first_file += 2;
+      }
+      else
+      {
+        break;
+      }
+    }
+  }
+  catch (const runtime_error &error)
+  {
+    cerr << "khipro: " << error.what() << endl;
+    return 1;
+  }
+
+  if (!serve_path.empty())
+  {
+    return serve(serve_path, threads ? threads : max(thread::hardware_concurrency(), 1u), keys, use_cache,
+                 show_stats);
+  }
+  if (!connect_path.empty())
+  {
+    char stdin_path[] = "-";
+    char *stdin_paths[] = {stdin_path};
+    bool only_stats = argc == first_file && show_stats;
+    return argc > first_file || only_stats
+               ? run_client(connect_path, argv + first_file, argc - first_file, keys, show_stats)
+               : run_client(connect_path, stdin_paths, 1, keys, show_stats);
+  }
+
+  if (argc > first_file)
+  {
+    unique_ptr<transliteration_pool> pool;
+    if (threads > 1)
+    {
+      pool = make_unique<transliteration_pool>(threads, keys);
+    }
+    unique_ptr<reverse_transliterator> reverse_engine;
+    if (reverse)
+    {
+      reverse_engine = make_unique<reverse_transliterator>(keys);
+    }
+    unique_ptr<word_cache> cache;
+    unique_ptr<concurrent_word_cache> shared_cache;
+    if (use_cache && pool)
+    {
+      shared_cache = make_unique<concurrent_word_cache>(1 << 16, keys);
+      pool->set_word_cache(shared_cache.get());
+    }
+    else if (use_cache)
+    {
+      cache = make_unique<word_cache>(1 << 16, keys);
+    }
+    int status = 0;
+    for (int i = first_file; i < argc; ++i)
+    {
+      string path = argv[i];
+      int fd = path == "-" ? STDIN_FILENO : open(argv[i], O_RDONLY);
+      size_t malformed_before = 0;
+      if (utf8)
+      {
+        malformed_before = utf8->malformed;
+        utf8->first_malformed = string_view::npos;
+      }
+      bool ok = fd >= 0 && (reverse ? reverse_fd(fd, STDOUT_FILENO, path, *reverse_engine)
+                                    : transliterate_fd(fd, STDOUT_FILENO, keys, pool.get(), cache.get(), utf8.get()));
+      if (!ok && errno == EILSEQ && utf8 && utf8->malformed != malformed_before)
+      {
+        cerr << "khipro: " << path << ": malformed UTF-8 at byte " << utf8->first_malformed << endl;
+        status = 1;
+      }
+      else if (!ok)
+      {
+        cerr << "khipro: " << path << ": " << strerror(errno) << endl;
+        status = 1;
+      }
+      if (fd > STDIN_FILENO)
+      {
+        close(fd);
+      }
+    }
+    if (show_stats)
+    {
+      print_stats(stderr);
+      if (utf8)
+      {
+        fprintf(stderr, "%-20s %zu\n", "malformed UTF-8", utf8->malformed);
+      }
+      if (use_cache)
+      {
+        word_cache_stats counts = cache ? cache->stats() : shared_cache->stats();
+        fprintf(stderr, "%-20s %llu hits, %llu misses, %llu uncached, %llu generations\n", "word cache",
+                (unsigned long long)counts.hits, (unsigned long long)counts.misses,
+                (unsigned long long)counts.uncached, (unsigned long long)counts.generations);
+      }
+    }
+    return status;
+  }
+
+  cout << "khipro cpp" << endl;
+  cout << "type 'exit' to quit." << endl;
+
+  // Both engines build tables up front, so only when asked for.
+  unique_ptr<reverse_transliterator> reverse_engine;
+  unique_ptr<suggestion_engine> suggestions;
+  if (suggestion_count != 0)
+  {
+    suggestions = make_unique<suggestion_engine>(keys, model);
+  }
+  else if (reverse)
+  {
+    reverse_engine = make_unique<reverse_transliterator>(keys);
+  }
+  string sample_input;
+  string result;
+  while (true)
+  {
+    cout << "Enter input: ";
+    getline(cin, sample_input);
+
+    if (sample_input == "exit")
+    {
+      break;
+    }
+
+    result.clear();
+    if (suggestion_count != 0)
+    {
+      suggestions->set_input(sample_input);
+      for (const suggestion &candidate : suggestions->suggest(suggestion_count))
+      {
+        result += (result.empty() ? "" : "  ") + candidate.text;
+      }
+    }
+    else if (!reverse)
+    {
+      transliterate(sample_input, result, keys);
+    }
+    else if (!reverse_engine->transliterate_back(sample_input, result))
+    {
+      result = "(no key sequence)";
+    }
+    cout << "Output: " << result << endl;
+  }
+  if (show_stats)
+  {
+    print_stats(stdout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "khipro.h"
+#include "khipro_check.h"
+
+using namespace std;
+using namespace khipro;
+
+// khipro_fuzz [seconds] [seed]: checks every engine against
+// reference_transliterate() on random short inputs until seconds (10 by
+// default) have passed. Inputs mix key letters, digits, punctuation, tabs
+// and Bengali, so keys run into each other and into pass-through text.
+int main(int argc, char **argv)
+{
+  double fuzz_seconds = argc > 1 ? atof(argv[1]) : 10;
+  mt19937 rng(argc > 2 ? strtoul(argv[2], nullptr, 10) : random_device()());
+  size_t checked = 0;
+  size_t failures = 0;
+  const string alphabet = "abcdefghijklmnopqrstuvwxyzAZ0189 ,.;/`~$+-=@\tকা";
+  auto start = chrono::steady_clock::now();
+  while (chrono::duration<double>(chrono::steady_clock::now() - start).count() < fuzz_seconds)
+  {
+    string input(rng() % 24, ' ');
+    for (char &c : input)
+    {
+      c = alphabet[rng() % alphabet.length()];
+    }
+    string expected = reference_transliterate(input);
+    string engine = check_engines(input, expected);
+    ++checked;
+    if (!engine.empty() && ++failures <= 20)
+    {
+      cout << "FAIL " << engine << ": \"" << input << "\" expected \"" << expected << "\"" << endl;
+    }
+  }
+
+  cout << "fuzz: " << checked << " checks, " << failures << " failures" << endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,771 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "khipro_server.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace khipro
+{
+
+namespace
+{
+
+// epoll tokens; connections are numbered after them.
+constexpr uint64_t listen_token = 0;
+constexpr uint64_t wake_token = 1;
+
+constexpr size_t socket_read_size = 64 << 10;
+
+uint64_t server_clock()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void append_le32(string &out, uint32_t value)
+{
+  char bytes[4] = {char(value), char(value >> 8), char(value >> 16), char(value >> 24)};
+  out.append(bytes, 4);
+}
+
+void write_le32(char *at, uint32_t value)
+{
+  at[0] = char(value);
+  at[1] = char(value >> 8);
+  at[2] = char(value >> 16);
+  at[3] = char(value >> 24);
+}
+
+uint32_t read_le32(const char *at)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(at);
+  return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+sockaddr_un socket_address(const string &socket_path)
+{
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.length() >= sizeof(address.sun_path))
+  {
+    throw runtime_error(socket_path + ": not a usable socket path");
+  }
+  memcpy(address.sun_path, socket_path.data(), socket_path.length());
+  return address;
+}
+
+} // namespace
+
+void append_frame(string &out, uint8_t type, string_view payload)
+{
+  append_le32(out, payload.length());
+  out += char(type);
+  out += payload;
+}
+
+void append_batch(string &out, const string_view *items, size_t count)
+{
+  append_le32(out, count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    append_le32(out, items[i].length());
+    out += items[i];
+  }
+}
+
+bool parse_batch(string_view payload, vector<string_view> &items)
+{
+  items.clear();
+  if (payload.length() < 4)
+  {
+    return false;
+  }
+  uint32_t count = read_le32(payload.data());
+  size_t pos = 4;
+  items.reserve(min<size_t>(count, payload.length() / 4));
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if (payload.length() - pos < 4)
+    {
+      return false;
+    }
+    uint32_t length = read_le32(payload.data() + pos);
+    pos += 4;
+    if (payload.length() - pos < length)
+    {
+      return false;
+    }
+    items.push_back(payload.substr(pos, length));
+    pos += length;
+  }
+  return pos == payload.length();
+}
+
+string format_server_stats(const server_stats &stats)
+{
+  string text;
+  char line[64];
+  auto counter = [&](const char *name, uint64_t value)
+  {
+    snprintf(line, sizeof(line), "%-20s %llu\n", name, (unsigned long long)value);
+    text += line;
+  };
+
+  snprintf(line, sizeof(line), "%-20s %.1f\n", "seconds", stats.seconds);
+  text += line;
+  counter("connections", stats.connections);
+  counter("open connections", stats.open_connections);
+  counter("requests", stats.requests);
+  counter("batch items", stats.batch_items);
+  counter("bad requests", stats.bad_requests);
+  counter("bytes in", stats.bytes_in);
+  counter("bytes out", stats.bytes_out);
+  counter("jobs", stats.jobs);
+  snprintf(line, sizeof(line), "%-20s %.1f\n", "requests/s",
+           stats.seconds > 0 ? stats.requests / stats.seconds : 0.0);
+  text += line;
+  text += "request log2ns      ";
+  for (size_t i = 0; i < server_stats::latency_buckets; ++i)
+  {
+    if (stats.request_latency[i] != 0)
+    {
+      snprintf(line, sizeof(line), " %zu:%llu", i, (unsigned long long)stats.request_latency[i]);
+      text += line;
+    }
+  }
+  text += '\n';
+  return text;
+}
+
+transliteration_server::transliteration_server(const string &socket_path, unsigned threads, const keymap &keys,
+                                               concurrent_word_cache *cache)
+    : socket_path_(socket_path), keys_(keys), cache_(cache), next_connection_(wake_token + 1),
+      started_(server_clock())
+{
+  sockaddr_un address = socket_address(socket_path);
+  auto fail = [&](const string &message)
+  {
+    for (int fd : {listen_fd_, epoll_fd_, wake_fd_})
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+    throw runtime_error(socket_path + ": " + message);
+  };
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0)
+  {
+    fail(strerror(errno));
+  }
+  int bound = ::bind(listen_fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+  if (bound != 0 && errno == EADDRINUSE)
+  {
+    // A socket nobody accepts on was left by a server that died.
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool live = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    if (probe >= 0)
+    {
+      close(probe);
+    }
+    if (live)
+    {
+      fail("a server is already listening");
+    }
+    unlink(socket_path.c_str());
+    bound = ::bind(listen_fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+  }
+  if (bound != 0 || listen(listen_fd_, SOMAXCONN) != 0)
+  {
+    fail(strerror(errno));
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || wake_fd_ < 0)
+  {
+    unlink(socket_path.c_str());
+    fail(strerror(errno));
+  }
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = listen_token;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+  event.data.u64 = wake_token;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+  for (unsigned i = 0; i < max(threads, 1u); ++i)
+  {
+    workers_.emplace_back(&transliteration_server::work, this);
+  }
+}
+
+transliteration_server::~transliteration_server()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    workers_stopping_ = true;
+  }
+  queued_.notify_all();
+  for (thread &worker : workers_)
+  {
+    worker.join();
+  }
+  for (auto &entry : connections_)
+  {
+    if (entry.second.fd >= 0)
+    {
+      close(entry.second.fd);
+    }
+  }
+  close(listen_fd_);
+  close(epoll_fd_);
+  close(wake_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void transliteration_server::run()
+{
+  epoll_event events[64];
+  while (!stopping_.load())
+  {
+    int count = epoll_wait(epoll_fd_, events, 64, -1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      uint64_t token = events[i].data.u64;
+      if (token == listen_token)
+      {
+        accept_connections();
+        continue;
+      }
+      if (token == wake_token)
+      {
+        uint64_t value;
+        if (read(wake_fd_, &value, sizeof(value)) > 0)
+        {
+          finish_jobs();
+        }
+        continue;
+      }
+      auto found = connections_.find(token);
+      if (found == connections_.end())
+      {
+        continue;
+      }
+      connection &client = found->second;
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        // The peer is gone, so nothing is left to answer.
+        drop(client);
+      }
+      else
+      {
+        if (events[i].events & EPOLLIN)
+        {
+          read_from(client);
+        }
+        if (events[i].events & EPOLLOUT)
+        {
+          write_to(client);
+        }
+      }
+      update(token, client);
+    }
+  }
+}
+
+void transliteration_server::stop()
+{
+  stopping_ = true;
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+server_stats transliteration_server::stats() const
+{
+  server_stats stats = {};
+  stats.seconds = (server_clock() - started_) / 1e9;
+  stats.connections = connection_count_.load();
+  stats.open_connections = open_connections_.load();
+  stats.requests = requests_.load();
+  stats.batch_items = batch_items_.load();
+  stats.bad_requests = bad_requests_.load();
+  stats.bytes_in = bytes_in_.load();
+  stats.bytes_out = bytes_out_.load();
+  stats.jobs = jobs_.load();
+  for (size_t i = 0; i < server_stats::latency_buckets; ++i)
+  {
+    stats.request_latency[i] = request_latency_[i].load();
+  }
+  return stats;
+}
+
+void transliteration_server::accept_connections()
+{
+  while (true)
+  {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      return;
+    }
+    uint64_t id = next_connection_++;
+    connection &client = connections_[id];
+    client.fd = fd;
+    client.events = EPOLLIN;
+    epoll_event event = {};
+    event.events = client.events;
+    event.data.u64 = id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    ++connection_count_;
+    ++open_connections_;
+  }
+}
+
+// Reads everything available, up to buffer_limit.
+void transliteration_server::read_from(connection &client)
+{
+  char buffer[socket_read_size];
+  while (!client.finished && !client.broken && client.input.length() < buffer_limit)
+  {
+    ssize_t count = read(client.fd, buffer, sizeof(buffer));
+    if (count > 0)
+    {
+      if (client.input_since == 0)
+      {
+        client.input_since = server_clock();
+      }
+      client.input.append(buffer, count);
+      bytes_in_ += count;
+    }
+    else if (count == 0)
+    {
+      client.finished = true;
+    }
+    else if (errno != EINTR)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        drop(client);
+      }
+      return;
+    }
+  }
+}
+
+void transliteration_server::write_to(connection &client)
+{
+  while (!client.broken && client.output_sent < client.output.length())
+  {
+    ssize_t count = send(client.fd, client.output.data() + client.output_sent,
+                         client.output.length() - client.output_sent, MSG_NOSIGNAL);
+    if (count >= 0)
+    {
+      client.output_sent += count;
+      bytes_out_ += count;
+    }
+    else if (errno != EINTR)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        drop(client);
+      }
+      break;
+    }
+  }
+  if (client.output_sent == client.output.length())
+  {
+    client.output.clear();
+    client.output_sent = 0;
+  }
+  else if (client.output_sent >= socket_read_size)
+  {
+    client.output.erase(0, client.output_sent);
+    client.output_sent = 0;
+  }
+}
+
+// Hands the complete requests at the front of client's input, up to
+// job_size bytes of them, to the workers.
+void transliteration_server::dispatch(uint64_t id, connection &client)
+{
+  size_t end = 0;
+  size_t request_count = 0;
+  bool deferred = false;
+  while (client.input.length() - end >= server_frame_header)
+  {
+    size_t length = read_le32(client.input.data() + end);
+    if (length > server_max_payload)
+    {
+      client.refused = true;
+      break;
+    }
+    if (client.input.length() - end - server_frame_header < length)
+    {
+      break;
+    }
+    if (request_count != 0 && end + server_frame_header + length > job_size)
+    {
+      deferred = true;
+      break;
+    }
+    end += server_frame_header + length;
+    ++request_count;
+  }
+  if (request_count == 0)
+  {
+    return;
+  }
+
+  job work = {id, string(), string(), request_count, client.input_since};
+  if (end == client.input.length())
+  {
+    work.requests.swap(client.input);
+    client.input_since = 0;
+  }
+  else
+  {
+    work.requests.assign(client.input, 0, end);
+    client.input.erase(0, end);
+    // Requests left for the next job are timed from now, not from the first
+    // request's arrival, which would charge them this job's time too.
+    if (deferred)
+    {
+      client.input_since = server_clock();
+    }
+  }
+  client.busy = true;
+  ++jobs_;
+  {
+    lock_guard<mutex> lock(mutex_);
+    queue_.push_back(move(work));
+  }
+  queued_.notify_one();
+}
+
+// Brings client up to date after its state changed: starts its next job,
+// answers a refused frame, closes it once done, or otherwise sets which
+// events to wait for.
+void transliteration_server::update(uint64_t id, connection &client)
+{
+  size_t unsent = client.output.length() - client.output_sent;
+  if (!client.busy && !client.broken && unsent < buffer_limit)
+  {
+    dispatch(id, client);
+    if (!client.busy && client.refused)
+    {
+      append_frame(client.output, SERVER_BAD_REQUEST,
+                   "request longer than " + to_string(server_max_payload) + " bytes");
+      ++bad_requests_;
+      client.input.clear();
+      client.refused = false;
+      client.finished = true;
+      write_to(client);
+      unsent = client.output.length() - client.output_sent;
+    }
+  }
+  if (!client.busy && (client.broken || (client.finished && unsent == 0)))
+  {
+    drop(client);
+    connections_.erase(id);
+    --open_connections_;
+    return;
+  }
+  if (client.broken)
+  {
+    return;
+  }
+
+  uint32_t events = 0;
+  if (!client.finished && client.input.length() < buffer_limit && unsent < buffer_limit)
+  {
+    events |= EPOLLIN;
+  }
+  if (unsent != 0)
+  {
+    events |= EPOLLOUT;
+  }
+  if (events != client.events)
+  {
+    epoll_event event = {};
+    event.events = events;
+    event.data.u64 = id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client.fd, &event);
+    client.events = events;
+  }
+}
+
+// Closes client's socket at once; its entry stays until no job is out.
+void transliteration_server::drop(connection &client)
+{
+  if (client.fd >= 0)
+  {
+    close(client.fd);
+    client.fd = -1;
+  }
+  client.broken = true;
+}
+
+void transliteration_server::finish_jobs()
+{
+  vector<job> finished;
+  {
+    lock_guard<mutex> lock(mutex_);
+    finished.swap(done_);
+  }
+  uint64_t now = server_clock();
+  for (job &work : finished)
+  {
+    uint64_t nanoseconds = now - work.received;
+    size_t bucket = min<size_t>(64 - (nanoseconds ? __builtin_clzll(nanoseconds) : 64),
+                                server_stats::latency_buckets - 1);
+    request_latency_[bucket] += work.request_count;
+
+    connection &client = connections_.at(work.connection);
+    client.busy = false;
+    if (!client.broken)
+    {
+      if (client.output.empty())
+      {
+        client.output.swap(work.responses);
+      }
+      else
+      {
+        client.output += work.responses;
+      }
+      write_to(client);
+    }
+    update(work.connection, client);
+  }
+}
+
+// Appends a response to every request of work.
+void transliteration_server::answer(job &work, transliteration_batch &batch, vector<string_view> &items)
+{
+  string_view requests = work.requests;
+  string &out = work.responses;
+  size_t bad = 0;
+  size_t batch_item_count = 0;
+  for (size_t pos = 0; pos < requests.length();)
+  {
+    size_t length = read_le32(requests.data() + pos);
+    uint8_t type = requests[pos + 4];
+    string_view payload = requests.substr(pos + server_frame_header, length);
+    pos += server_frame_header + length;
+
+    size_t start = out.length();
+    out.append(server_frame_header, '\0');
+    out[start + 4] = char(SERVER_OK);
+    const char *error = nullptr;
+    switch (type)
+    {
+    case SERVER_TRANSLITERATE:
+      if (cache_)
+      {
+        cache_->transliterate(payload, out);
+      }
+      else
+      {
+        transliterate(payload, out, keys_);
+      }
+      break;
+    case SERVER_BATCH:
+      if (!parse_batch(payload, items))
+      {
+        error = "malformed batch";
+        break;
+      }
+      batch.clear();
+      transliterate_batch(items.data(), items.size(), batch, keys_);
+      append_le32(out, batch.size());
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+        append_le32(out, batch[i].length());
+        out += batch[i];
+      }
+      batch_item_count += items.size();
+      break;
+    case SERVER_STATS:
+      out += format_server_stats(stats());
+      break;
+    default:
+      error = "unknown request type";
+      break;
+    }
+    if (error)
+    {
+      out.resize(start + server_frame_header);
+      out[start + 4] = char(SERVER_BAD_REQUEST);
+      out += error;
+      ++bad;
+    }
+    write_le32(&out[start], out.length() - start - server_frame_header);
+  }
+  requests_ += work.request_count;
+  batch_items_ += batch_item_count;
+  bad_requests_ += bad;
+}
+
+void transliteration_server::work()
+{
+  transliteration_batch batch;
+  vector<string_view> items;
+  unique_lock<mutex> lock(mutex_);
+  while (true)
+  {
+    queued_.wait(lock, [&] { return workers_stopping_ || !queue_.empty(); });
+    if (workers_stopping_)
+    {
+      return;
+    }
+    job work = move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    answer(work, batch, items);
+    lock.lock();
+    done_.push_back(move(work));
+    if (done_.size() == 1)
+    {
+      // The loop takes all of done_ per wakeup, so only the first job
+      // needs one.
+      uint64_t one = 1;
+      ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+      (void)ignored;
+    }
+  }
+}
+
+server_connection::server_connection(const string &socket_path)
+{
+  sockaddr_un address = socket_address(socket_path);
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 || connect(fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+  {
+    string error = strerror(errno);
+    if (fd_ >= 0)
+    {
+      close(fd_);
+    }
+    throw runtime_error(socket_path + ": " + error);
+  }
+}
+
+server_connection::~server_connection()
+{
+  close(fd_);
+}
+
+bool server_connection::send(server_request type, string_view payload)
+{
+  frame_.clear();
+  append_frame(frame_, type, payload);
+  return send_frames(frame_);
+}
+
+bool server_connection::send_frames(string_view frames)
+{
+  while (!frames.empty())
+  {
+    ssize_t count = ::send(fd_, frames.data(), frames.length(), MSG_NOSIGNAL);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    frames.remove_prefix(count);
+  }
+  return true;
+}
+
+void server_connection::finish_sending()
+{
+  shutdown(fd_, SHUT_WR);
+}
+
+bool server_connection::receive(uint8_t &status, string &payload)
+{
+  while (true)
+  {
+    size_t available = input_.length() - input_start_;
+    size_t wanted = server_frame_header;
+    if (available >= server_frame_header)
+    {
+      wanted += read_le32(input_.data() + input_start_);
+      if (available >= wanted)
+      {
+        status = input_[input_start_ + 4];
+        payload.assign(input_, input_start_ + server_frame_header, wanted - server_frame_header);
+        input_start_ += wanted;
+        return true;
+      }
+    }
+    input_.erase(0, input_start_);
+    input_start_ = 0;
+    char buffer[socket_read_size];
+    ssize_t count = read(fd_, buffer, sizeof(buffer));
+    if (count == 0 || (count < 0 && errno != EINTR))
+    {
+      return false;
+    }
+    input_.append(buffer, max<ssize_t>(count, 0));
+  }
+}
+
+} // namespace khipro
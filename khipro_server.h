@@ -0,0 +1,239 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef KHIPRO_SERVER_H
+#define KHIPRO_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "khipro.h"
+
+namespace khipro
+{
+
+// Wire format, over a Unix stream socket. Every message is a frame: a
+// 4-byte little-endian payload length, a type byte and the payload.
+// Requests carry a server_request type, responses a server_status; a
+// response with SERVER_BAD_REQUEST carries an error message. Clients may
+// send any number of requests before reading, and responses come back in
+// request order.
+enum server_request : uint8_t
+{
+  // Payload: text. Response: its transliteration.
+  SERVER_TRANSLITERATE = 1,
+  // Payload: a batch (see append_batch()). Response: a batch of the
+  // transliterations, in order.
+  SERVER_BATCH = 2,
+  // Empty payload. Response: format_server_stats() text.
+  SERVER_STATS = 3,
+};
+
+enum server_status : uint8_t
+{
+  SERVER_OK = 0,
+  SERVER_BAD_REQUEST = 1,
+};
+
+constexpr size_t server_frame_header = 5;
+
+// Frames with longer payloads are refused and the connection closed.
+constexpr size_t server_max_payload = 16 << 20;
+
+void append_frame(std::string &out, uint8_t type, std::string_view payload);
+
+// A batch payload is a 4-byte little-endian count followed by that many
+// items, each a 4-byte little-endian length and the bytes.
+void append_batch(std::string &out, const std::string_view *items, size_t count);
+
+// Splits a batch payload into items pointing into it, returning false if it
+// is malformed.
+bool parse_batch(std::string_view payload, std::vector<std::string_view> &items);
+
+// Server counters. Latency runs from when a request's bytes started arriving
+// to its response being queued for writing, so it includes waiting for a
+// worker and for earlier requests on the same connection.
+struct server_stats
+{
+  static constexpr size_t latency_buckets = 32;
+
+  double seconds;
+  uint64_t connections;
+  uint64_t open_connections;
+  uint64_t requests;
+  uint64_t batch_items;
+  uint64_t bad_requests;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  // Requests are handed to workers in jobs of everything complete on a
+  // connection, so pipelined requests share one.
+  uint64_t jobs;
+  // Bucket b counts requests taking [2^(b-1), 2^b) nanoseconds.
+  uint64_t request_latency[latency_buckets];
+};
+
+// One line per counter; histograms list only non-empty buckets, as
+// "bucket:count".
+std::string format_server_stats(const server_stats &stats);
+
+// Serves transliterate() on a Unix socket. One thread runs an epoll loop
+// that does all socket I/O and framing; workers transliterate. Each
+// connection has at most one job out at a time, holding every request it
+// had complete, so responses stay in order and pipelined requests cost one
+// hand-off; separate connections run in parallel.
+class transliteration_server
+{
+public:
+  // Listens on socket_path, replacing a stale socket left there but not a
+  // live server. cache, if given, must outlive the server and use keys.
+  // Throws runtime_error on failure.
+  transliteration_server(const std::string &socket_path, unsigned threads, const keymap &keys = keymap::builtin(),
+                         concurrent_word_cache *cache = nullptr);
+  ~transliteration_server();
+
+  transliteration_server(const transliteration_server &) = delete;
+  transliteration_server &operator=(const transliteration_server &) = delete;
+
+  // Serves until stop().
+  void run();
+
+  // Safe from any thread and from signal handlers.
+  void stop();
+
+  server_stats stats() const;
+
+private:
+  // Complete requests beyond this wait for the next job.
+  static constexpr size_t job_size = 1 << 20;
+  // Connections with this much unanswered input or unsent output are not
+  // read from until it drains.
+  static constexpr size_t buffer_limit = 64 << 20;
+
+  struct connection
+  {
+    int fd;
+    std::string input;
+    std::string output;
+    size_t output_sent = 0;
+    uint64_t input_since = 0;
+    uint32_t events = 0;
+    bool busy = false;
+    bool finished = false;
+    bool broken = false;
+    bool refused = false;
+  };
+
+  struct job
+  {
+    uint64_t connection;
+    std::string requests;
+    std::string responses;
+    size_t request_count;
+    uint64_t received;
+  };
+
+  void accept_connections();
+  void read_from(connection &client);
+  void write_to(connection &client);
+  void dispatch(uint64_t id, connection &client);
+  void update(uint64_t id, connection &client);
+  void drop(connection &client);
+  void finish_jobs();
+  void answer(job &work, transliteration_batch &batch, std::vector<std::string_view> &items);
+  void work();
+
+  std::string socket_path_;
+  keymap keys_;
+  concurrent_word_cache *cache_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::atomic<bool> stopping_{false};
+  uint64_t next_connection_ = 0;
+  std::unordered_map<uint64_t, connection> connections_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::deque<job> queue_;
+  std::vector<job> done_;
+  bool workers_stopping_ = false;
+
+  uint64_t started_;
+  std::atomic<uint64_t> connection_count_{0};
+  std::atomic<uint64_t> open_connections_{0};
+  std::atomic<uint64_t> requests_{0};
+  std::atomic<uint64_t> batch_items_{0};
+  std::atomic<uint64_t> bad_requests_{0};
+  std::atomic<uint64_t> bytes_in_{0};
+  std::atomic<uint64_t> bytes_out_{0};
+  std::atomic<uint64_t> jobs_{0};
+  std::atomic<uint64_t> request_latency_[server_stats::latency_buckets] = {};
+};
+
+// Blocking client side of a server connection. Sending and receiving may
+// run on different threads, which is how a client pipelines.
+class server_connection
+{
+public:
+  // Throws runtime_error if nothing is listening on socket_path.
+  explicit server_connection(const std::string &socket_path);
+  ~server_connection();
+
+  server_connection(const server_connection &) = delete;
+  server_connection &operator=(const server_connection &) = delete;
+
+  bool send(server_request type, std::string_view payload);
+
+  // Writes out frames already built with append_frame().
+  bool send_frames(std::string_view frames);
+
+  // Tells the server no more requests follow; it closes the connection
+  // after answering the rest.
+  void finish_sending();
+
+  // Reads the next response, returning false at end of stream or on error.
+  bool receive(uint8_t &status, std::string &payload);
+
+private:
+  int fd_;
+  std::string frame_;
+  std::string input_;
+  size_t input_start_ = 0;
+};
+
+} // namespace khipro
+
+#endif
@@ -0,0 +1,422 @@
+// Copyright (c) Jayed Ahsan Saad
+//
+// This is a C++ port of the khipro-python, which is licensed
+// under the MIT License.
+//
+// Original project: https://github.com/rank-coder/khipro-python
+// Copyright (c) 2025 rank_coder
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "khipro.h"
+#include "khipro_check.h"
+#include "khipro_server.h"
+
+using namespace std;
+using namespace khipro;
+
+// Differentially checks the engines against reference_transliterate() over
+// golden_cases(). With golden_path, also checks them against the outputs
+// recorded there by record_golden(), which catches changes to the tables
+// that the reference, built from the same tables, would follow.
+int run_verify(const char *golden_path)
+{
+  size_t checked = 0;
+  size_t failures = 0;
+  auto check = [&](const string &input, const string &expected, const string &engine)
+  {
+    ++checked;
+    if (engine.empty())
+    {
+      return;
+    }
+    if (++failures <= 20)
+    {
+      cout << "FAIL " << engine << ": \"" << input << "\" expected \"" << expected << "\"" << endl;
+    }
+  };
+
+  vector<string> cases = golden_cases();
+  vector<string> expected_outputs;
+  string joined_input;
+  string joined_expected;
+  for (const string &input : cases)
+  {
+    string expected = reference_transliterate(input);
+    check(input, expected, check_engines(input, expected));
+    expected_outputs.push_back(expected);
+    joined_input += input + "\n";
+    joined_expected += expected + "\n";
+  }
+
+  string output_str;
+  transliteration_pool pool(8);
+  pool.transliterate(joined_input, output_str);
+  check("<all cases>", "<reference>", output_str == joined_expected ? "" : "transliteration_pool");
+
+  concurrent_word_cache shared_cache(64);
+  pool.set_word_cache(&shared_cache);
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    output_str.clear();
+    pool.transliterate(joined_input, output_str);
+    check("<all cases>", "<reference>", output_str == joined_expected ? "" : "concurrent_word_cache");
+  }
+  pool.set_word_cache(nullptr);
+
+  // Blocks back to back, as -j streams them: a worker that wakes late for
+  // one block must not touch the pieces of the next.
+  string stress_input;
+  while (stress_input.length() < (1 << 20))
+  {
+    stress_input += joined_input;
+  }
+  string stress_expected = transliterate(stress_input);
+  for (size_t round = 0; round < 40; ++round)
+  {
+    output_str.clear();
+    bool previous_was_consonant = false;
+    size_t block_size = (128 << 10) + round * 4099;
+    for (size_t pos = 0; pos < stress_input.length();)
+    {
+      size_t end = min(stress_input.length(), pos + block_size);
+      pos += pool.transliterate_block(string_view(stress_input).substr(pos, end - pos), previous_was_consonant,
+                                      end == stress_input.length());
+      for (size_t i = 0; i < pool.piece_count(); ++i)
+      {
+        output_str += pool.piece_output(i);
+      }
+    }
+    check("<stress>", "<serial>", output_str == stress_expected ? "" : "transliteration_pool blocks");
+  }
+
+  // A model that prefers কখ over ক্ষ ranks it right after the plain
+  // output.
+  suggestion_engine ranked(keymap::builtin(), language_model::parse("10\tক\n10\tখ\n1\tক্ষ\n10\tক\tখ\n"));
+  ranked.set_input("kkh");
+  const vector<suggestion> &ranked_suggestions = ranked.suggest(3);
+  check("kkh", "ক্ষ কখ",
+        ranked_suggestions.size() >= 2 && ranked_suggestions[0].text == "ক্ষ" && ranked_suggestions[1].text == "কখ"
+            ? ""
+            : "language_model");
+
+  // Repeated lines add up, bigrams like unigrams.
+  language_model repeated = language_model::parse("3\tক\n2\tক\n4\tখ\n1\tক\tখ\n2\tক\tখ\n1\tক\tক\n");
+  language_model summed = language_model::parse("5\tক\n4\tখ\n3\tক\tখ\n1\tক\tক\n");
+  uint32_t ka = summed.token_id("ক");
+  uint32_t kha = summed.token_id("খ");
+  check("<repeated model lines>", "<summed>",
+        repeated.cost(ka, kha) == summed.cost(ka, kha) && repeated.cost(ka, ka) == summed.cost(ka, ka) &&
+                repeated.cost(language_model::word_start, kha) == summed.cost(language_model::word_start, kha)
+            ? ""
+            : "language_model");
+
+  transliteration_batch batch;
+  transliterate_batch(cases.data(), cases.size(), batch);
+  for (size_t i = 0; i < cases.size(); ++i)
+  {
+    check(cases[i], "<reference>", batch[i] == transliterate(cases[i]) ? "" : "transliterate_batch");
+  }
+
+  // Layout strings take \u escapes, surrogate pairs included; malformed
+  // ones are layout errors.
+  keymap escaped = keymap::from_layout("[vowels]\n\"q\" \"\\u0995\\ud83d\\ude00\"\n");
+  check("q", "ক😀", transliterate("q", escaped) == "ক😀" ? "" : "from_layout \\u escape");
+  for (const char *bad : {"\\uZZZZ", "\\u12", "\\ud83d", "\\ude00", "\\ud83d\\u0041"})
+  {
+    string error;
+    try
+    {
+      keymap::from_layout(string("[vowels]\n\"q\" \"") + bad + "\"\n");
+      error = "from_layout accepted a bad \\u escape";
+    }
+    catch (const runtime_error &)
+    {
+    }
+    check(bad, "<layout error>", error);
+  }
+
+  // A one-line Python dictionary is a section, layouts load from pipes, and
+  // a phola value must leave room for its hasanta.
+  string layout_error;
+  try
+  {
+    int layout_pipe[2];
+    if (pipe(layout_pipe) == 0)
+    {
+      string layout = "vowels_map = {\"o\": \"x\", \"q\": \"y\"}\n[phola]\n\"z\" \"" + string(252, 'a') + "\"\n";
+      bool written = write(layout_pipe[1], layout.data(), layout.length()) == ssize_t(layout.length());
+      close(layout_pipe[1]);
+      keymap piped = keymap::load("/dev/fd/" + to_string(layout_pipe[0]));
+      close(layout_pipe[0]);
+      if (!written || transliterate("oqzz", piped) != "xy" + string(252, 'a') + "্" + string(252, 'a'))
+      {
+        layout_error = "from_layout";
+      }
+    }
+  }
+  catch (const runtime_error &error)
+  {
+    layout_error = string("from_layout: ") + error.what();
+  }
+  check("vowels_map = {...}", "<loaded>", layout_error);
+  layout_error = "from_layout accepted an overlong phola value";
+  try
+  {
+    keymap::from_layout("[phola]\n\"z\" \"" + string(253, 'a') + "\"\n");
+  }
+  catch (const runtime_error &)
+  {
+    layout_error.clear();
+  }
+  check("<253-byte phola>", "<layout error>", layout_error);
+
+  // The built-in layout must survive the text format and a compiled image
+  // unchanged.
+  char compiled_path[] = "/tmp/khipro-verify-XXXXXX";
+  int compiled_fd = mkstemp(compiled_path);
+  if (compiled_fd >= 0)
+  {
+    close(compiled_fd);
+    keymap::from_layout(format_layout()).save_compiled(compiled_path);
+    keymap loaded = keymap::load(compiled_path);
+    unlink(compiled_path);
+    output_str.clear();
+    transliterate(joined_input, output_str, loaded);
+    check("<all cases>", "<reference>", output_str == joined_expected ? "" : "compiled layout");
+
+    // So must one reordered for a profile, before and after saving.
+    keymap reordered = keymap::builtin().reorder(profile_keys(joined_input));
+    reordered.save_compiled(compiled_path);
+    loaded = keymap::load(compiled_path);
+    unlink(compiled_path);
+    for (const keymap *keys : {&reordered, &loaded})
+    {
+      output_str.clear();
+      transliterate(joined_input, output_str, *keys);
+      check("<all cases>", "<reference>", output_str == joined_expected ? "" : "reordered layout");
+      check("<all cases>", "<tokens>", tokenize(joined_input, *keys) == tokenize(joined_input) ? "" : "reordered layout");
+    }
+
+    // Corrupt images are refused: an output whose end wraps past the pool
+    // in 32 bits, a transition that makes a cycle, and start byte tables that
+    // disagree with the transitions.
+    keymap::builtin().save_compiled(compiled_path);
+    ifstream saved(compiled_path, ios::binary);
+    const string image((istreambuf_iterator<char>(saved)), istreambuf_iterator<char>());
+    uint32_t class_count, node_count;
+    memcpy(&class_count, image.data() + 16, 4);
+    memcpy(&node_count, image.data() + 20, 4);
+    size_t transitions = 48 + 256 + 32;
+    size_t entries = (transitions + size_t(node_count) * class_count * 2 + node_count * 2 + 3) & ~size_t(3);
+    size_t free_slot = transitions + class_count * 2;
+    while (image[free_slot] != 0 || image[free_slot + 1] != 0)
+    {
+      free_slot += 2;
+    }
+    const pair<size_t, string> corruptions[] = {
+        {entries, string("\xf6\xff\xff\xff\xf6\xff\xff\xff\x0c\x0c", 10)},
+        {free_slot, string("\x01\x00", 2)},
+        {48 + 256, string("\xff", 1)},
+    };
+    for (size_t i = 0; i < size(corruptions); ++i)
+    {
+      string corrupt = image;
+      corrupt.replace(corruptions[i].first, corruptions[i].second.length(), corruptions[i].second);
+      ofstream(compiled_path, ios::binary | ios::trunc) << corrupt;
+      bool refused = false;
+      try
+      {
+        keymap::load(compiled_path);
+      }
+      catch (const runtime_error &)
+      {
+        refused = true;
+      }
+      check("<corrupt image " + to_string(i) + ">", "<refused>", refused ? "" : "view_image");
+    }
+
+    // A loaded image reorders too, even one whose entries all share the same
+    // pool bytes, so the reordered pool is larger than the loaded one.
+    string shared_pool = image;
+    uint32_t entry_count;
+    memcpy(&entry_count, image.data() + 24, 4);
+    for (size_t i = 0; i < entry_count; ++i)
+    {
+      shared_pool.replace(entries + i * 12, 10, string("\0\0\0\0\0\0\0\0\xc8\xc8", 10));
+    }
+    const string *images[] = {&image, &shared_pool};
+    for (const string *loaded_image : images)
+    {
+      ofstream(compiled_path, ios::binary | ios::trunc) << *loaded_image;
+      keymap loaded_keys = keymap::load(compiled_path);
+      string loaded_output = transliterate(joined_input, loaded_keys);
+      keymap reordered_keys = loaded_keys.reorder(profile_keys(joined_input, loaded_keys));
+      check("<all cases>", "<loaded image>",
+            transliterate(joined_input, reordered_keys) == loaded_output ? "" : "reordered loaded image");
+    }
+    unlink(compiled_path);
+  }
+
+  // A server answers pipelined requests, a batch and an unknown request in
+  // order, then closes once the client is done sending.
+  try
+  {
+    string socket_path = "/tmp/khipro-verify-" + to_string(getpid()) + ".sock";
+    transliteration_server server(socket_path, 2);
+    thread loop([&] { server.run(); });
+    {
+      server_connection client(socket_path);
+      string frames;
+      for (const string &input : cases)
+      {
+        append_frame(frames, SERVER_TRANSLITERATE, input);
+      }
+      vector<string_view> items(cases.begin(), cases.end());
+      string payload;
+      append_batch(payload, items.data(), items.size());
+      append_frame(frames, SERVER_BATCH, payload);
+      append_frame(frames, 0x7f, "");
+      thread sender([&]
+                    {
+                      client.send_frames(frames);
+                      client.finish_sending();
+                    });
+      uint8_t status;
+      for (size_t i = 0; i < cases.size(); ++i)
+      {
+        bool answered = client.receive(status, payload) && status == SERVER_OK && payload == expected_outputs[i];
+        check(cases[i], expected_outputs[i], answered ? "" : "transliteration_server");
+      }
+      bool answered = client.receive(status, payload) && status == SERVER_OK && parse_batch(payload, items) &&
+                      equal(items.begin(), items.end(), expected_outputs.begin(), expected_outputs.end());
+      check("<all cases>", "<reference>", answered ? "" : "transliteration_server batch");
+      answered = client.receive(status, payload) && status == SERVER_BAD_REQUEST && !client.receive(status, payload);
+      check("<unknown request>", "<bad request>", answered ? "" : "transliteration_server bad request");
+      sender.join();
+    }
+    server.stop();
+    loop.join();
+  }
+  catch (const runtime_error &error)
+  {
+    check("<server>", "<running>", string("transliteration_server: ") + error.what());
+  }
+
+  if (golden_path)
+  {
+    ifstream golden(golden_path);
+    check(golden_path, "<golden outputs>", golden ? "" : "cannot read golden file");
+    string line;
+    while (getline(golden, line))
+    {
+      size_t tab = line.find('\t');
+      string input = line.substr(0, tab);
+      string expected = tab == string::npos ? "" : line.substr(tab + 1);
+      check(input, expected, check_engines(input, expected));
+    }
+  }
+
+  // Replacement follows the examples of section 3.9 of the Unicode
+  // standard.
+  const pair<string, string> replacements[] = {
+      {"a\xf1\x80\x80\xe1\x80\xc2" "b\x80" "c\x80\xbf" "d", "a###b#c##d"},
+      {"\xc0\xaf\xe0\x80\xbf\xf0\x81\x82" "A", "########A"},
+      {"\xed\xa0\x80\xed\xbf\xbf\xed\xaf" "A", "########A"},
+      {"\xf4\x91\x92\x93\xff" "A\x80\xbf" "B", "#####A##B"},
+      {"\xe1\x80\xe2\xf0\x91\x92\xf1\xbf" "A", "####A"},
+  };
+  for (const auto &replacement : replacements)
+  {
+    string expected_input;
+    for (char c : replacement.second)
+    {
+      expected_input += c == '#' ? "\xef\xbf\xbd" : string(1, c);
+    }
+    string output_str;
+    bool previous_was_consonant = false;
+    transliterate_checked(replacement.first, output_str, previous_was_consonant, true, UTF8_REPLACE);
+    check(replacement.first, replacement.second,
+          output_str == transliterate(expected_input) ? "" : "transliterate_checked replacement");
+  }
+
+  // The vector UTF-8 checks against the oracle, over long mixes of ASCII,
+  // valid sequences and bytes that tend to break them, at every alignment.
+  mt19937 rng(1);
+  const char *utf8_pieces[] = {"a", "k", " ", "\n", "\xc3\xa9", "\xe0\xa6\x95", "\xe0\xa7\x8d", "\xf0\x9f\x98\x80",
+                               "\xed\x9f\xbf", "\xee\x80\x80", "\xf4\x8f\xbf\xbf", "\x80", "\xbf", "\xc0",
+                               "\xc2", "\xe0", "\xe0\xa6", "\xed\xa0\x80", "\xf0\x8f", "\xf4\x90\x80\x80",
+                               "\xf5", "\xff"};
+  const size_t utf8_piece_count = sizeof(utf8_pieces) / sizeof(utf8_pieces[0]);
+  for (int i = 0; i < 20000; ++i)
+  {
+    string text(rng() % 40, 'x');
+    size_t pieces = rng() % 80;
+    for (size_t piece = 0; piece < pieces; ++piece)
+    {
+      // Mostly valid, with an occasional bad piece.
+      size_t index = rng() % 8 == 0 ? rng() % utf8_piece_count : rng() % 11;
+      text += utf8_pieces[index];
+    }
+    check(text, "<oracle>", find_malformed_utf8(text) == reference_malformed_utf8(text) ? "" : "find_malformed_utf8");
+  }
+
+  cout << "verify: " << checked << " checks, " << failures << " failures" << endl;
+  return failures ? 1 : 0;
+}
+
+// Writes "input<TAB>output" for every golden case, as produced by the
+// reference implementation.
+int record_golden(const char *path)
+{
+  ofstream golden(path);
+  for (const string &input : golden_cases())
+  {
+    golden << input << '\t' << reference_transliterate(input) << '\n';
+  }
+  return golden ? 0 : 1;
+}
+
+// khipro_verify [golden-file] runs the checks; khipro_verify --record-golden
+// FILE records golden outputs.
+int main(int argc, char **argv)
+{
+  if (argc > 2 && string(argv[1]) == "--record-golden")
+  {
+    return record_golden(argv[2]);
+  }
+  return run_verify(argc > 1 ? argv[1] : nullptr);
+}